@@ -1,796 +1,419 @@
-// encoder.c  (Methods 0/1/2/3)
-// MMSP Final Project - Compatible CLI for method 0/1/2/3
-// - Method 0: BMP -> R/G/B txt + dim.txt
-// - Method 1: BMP -> QT txt + dim.txt + qF raw (int16) + eF raw (float32) + print SQNR_Freq (3x64)
-// - Method 2: BMP -> RLE (ascii or binary)  [pipeline: RGB->YCbCr->DCT->Quant->DPCM(DC)->ZigZag->RLE]
-// - Method 3: Method2-binary payload -> Huffman (ascii or binary), with codebook.txt
+// encoder.c  — command-line front end of the encoder library (mmsp.h, mmsp_enc.c)
+// MMSP Final Project - Compatible CLI for method 0/1/2/3/4/5
+// Reads input.bmp, runs mmsp_encode() and writes its output parts to the paths
+// given on the command line. Methods 2-5: "-" reads the BMP from stdin / writes
+// the code file to stdout; the BMP is never seeked.
+// --batch LIST runs many images as a read / encode / write pipeline (see Batch).
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <math.h>
-
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-/* ========================== BMP ========================== */
-#pragma pack(push,1)
-typedef struct {
-    uint16_t bfType;      // 'BM'
-    uint32_t bfSize;
-    uint16_t bfReserved1;
-    uint16_t bfReserved2;
-    uint32_t bfOffBits;
-} BMPFileHeader;
-
-typedef struct {
-    uint32_t biSize;      // 40
-    int32_t  biWidth;
-    int32_t  biHeight;    // + : bottom-up, - : top-down
-    uint16_t biPlanes;    // 1
-    uint16_t biBitCount;  // 24
-    uint32_t biCompression; // 0
-    uint32_t biSizeImage;
-    int32_t  biXPelsPerMeter;
-    int32_t  biYPelsPerMeter;
-    uint32_t biClrUsed;
-    uint32_t biClrImportant;
-} BMPInfoHeader;
-#pragma pack(pop)
+#include <time.h>
+#include <pthread.h>
+#include "mmsp.h"
 
 static void die(const char* msg){
     fprintf(stderr, "ERROR: %s\n", msg);
     exit(1);
 }
-static int row_size_24(int w){ return ((w*3 + 3)/4)*4; }
-
-static void load_bmp_topdown_rgb(
-    const char* path, int* W, int* H,
-    uint8_t** R, uint8_t** G, uint8_t** B,
-    uint8_t header54[54], int* has_header54
-){
-    FILE* f = fopen(path,"rb");
-    if(!f) die("Failed to open BMP");
-
-    BMPFileHeader fh;
-    BMPInfoHeader ih;
-    if(fread(&fh,sizeof(fh),1,f)!=1) die("BMP read header failed");
-    if(fread(&ih,sizeof(ih),1,f)!=1) die("BMP read info failed");
-
-    if(fh.bfType != 0x4D42) die("Not a BMP");
-    if(ih.biBitCount != 24 || ih.biCompression != 0) die("Only 24-bit uncompressed BMP supported");
-
-    // capture original 54B header for exact reproduction if needed
-    // rebuild the 54 bytes by seeking 0 and reading 54
-    long cur = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    size_t n = fread(header54, 1, 54, f);
-    *has_header54 = (n==54);
-    fseek(f, cur, SEEK_SET);
-
-    int w = ih.biWidth;
-    int h_abs = (ih.biHeight>0) ? ih.biHeight : -ih.biHeight;
-    int rs = row_size_24(w);
-
-    uint8_t* r = (uint8_t*)malloc((size_t)w*h_abs);
-    uint8_t* g = (uint8_t*)malloc((size_t)w*h_abs);
-    uint8_t* b = (uint8_t*)malloc((size_t)w*h_abs);
-    uint8_t* row = (uint8_t*)malloc((size_t)rs);
-    if(!r||!g||!b||!row) die("OOM");
-
-    fseek(f, fh.bfOffBits, SEEK_SET);
-
-    // read file rows, convert to TOP-DOWN indexing
-    for(int file_row=0; file_row<h_abs; file_row++){
-        if(fread(row,1,(size_t)rs,f)!=(size_t)rs) die("BMP pixel read failed");
-        int y = (ih.biHeight>0) ? (h_abs-1-file_row) : file_row; // top-down y
-        for(int x=0;x<w;x++){
-            uint8_t Bv = row[x*3 + 0];
-            uint8_t Gv = row[x*3 + 1];
-            uint8_t Rv = row[x*3 + 2];
-            r[y*w + x] = Rv;
-            g[y*w + x] = Gv;
-            b[y*w + x] = Bv;
-        }
-    }
-
-    free(row);
-    fclose(f);
-
-    *W = w; *H = h_abs;
-    *R = r; *G = g; *B = b;
-}
 
-/* ========================== DCT/IDCT (separable) ========================== */
-static double COS8[8][8]; // cos((2x+1)u*pi/16)
-static double ALPHA8[8];  // alpha(u)
-
-static void init_dct_table(void){
-    for(int u=0;u<8;u++){
-        ALPHA8[u] = (u==0)? (1.0/sqrt(2.0)) : 1.0;
-        for(int x=0;x<8;x++){
-            COS8[u][x] = cos(((2.0*x + 1.0)*u*M_PI)/16.0);
-        }
-    }
+static void usage(void){
+    printf("Usage:\n");
+    printf("  encoder 0 input.bmp R.txt G.txt B.txt dim.txt\n");
+    printf("  encoder 1 input.bmp Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt qF_Y.raw qF_Cb.raw qF_Cr.raw eF_Y.raw eF_Cb.raw eF_Cr.raw\n");
+    printf("  encoder 1 input.bmp Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt coef.raw   (interleaved qF+eF)\n");
+    printf("  encoder 2 input.bmp ascii  rle_code.txt\n");
+    printf("  encoder 2 input.bmp binary rle_code.bin\n");
+    printf("  encoder 3 input.bmp ascii  codebook.txt huffman_code.txt\n");
+    printf("  encoder 3 input.bmp binary codebook.txt huffman_code.bin\n");
+    printf("  encoder 4 input.bmp arith_code.bin\n");
+    printf("  encoder 5 input.bmp rans_code.bin\n");
+    printf("  (Methods 2-5: input.bmp and the code file may be - for stdin / stdout)\n");
+    printf("  encoder N --batch jobs.txt [options]   one job per line: the arguments after N\n");
+    printf("                                         (jobs.txt may be - for stdin)\n");
+    printf("Options:\n");
+    printf("  --table optimal|static|sampled[:N]   Method-3 Huffman table (default optimal)\n");
+    printf("  --progressive                        Method-2/3/5 binary payload as DC + AC band scans\n");
+    printf("  --index                              Method-2/3/5 binary payload with block-row index (crop decode)\n");
+    printf("  --lossless                           Method-2/3/4/5 bit-exact: YCoCg-R + reversible integer DCT, no quantization\n");
+    printf("  --sequence skip|delta                Method-2/3/5 image series (with --batch): blocks unchanged since\n");
+    printf("                                       the previous frame are skipped; delta codes changed ones as differences\n");
+    printf("  --dedup                              Method-2/3/5 repeated 8x8 blocks as references to earlier ones\n");
+    printf("  --color float|fixed                  RGB -> YCbCr in double (default) or 16-bit fixed point\n");
+    printf("  --precision double|float|int         forward DCT arithmetic (int implies --color fixed)\n");
+    printf("  --threads N                          Method-3 worker threads (default 0 = all CPUs; output is identical)\n");
+    printf("  --lambda L                           Method-1..5 rate-distortion optimized quantization (default 0 = off)\n");
+    printf("  --ef float|compact[:K]               Method-1 eF files as raw float32 (default) or Huffman-coded,\n");
+    printf("                                       rounded to K fraction bits (default 3)\n");
 }
 
-static void dct8x8(const double in[8][8], double out[8][8]){
-    // temp[u][y] = sum_x in[x][y] * cos(u,x)
-    double temp[8][8];
-    for(int u=0;u<8;u++){
-        for(int y=0;y<8;y++){
-            double s=0.0;
-            for(int x=0;x<8;x++) s += in[x][y]*COS8[u][x];
-            temp[u][y]=s;
-        }
-    }
-    // out[u][v] = 0.25 * alpha(u)alpha(v) * sum_y temp[u][y]*cos(v,y)
-    for(int u=0;u<8;u++){
-        for(int v=0;v<8;v++){
-            double s=0.0;
-            for(int y=0;y<8;y++) s += temp[u][y]*COS8[v][y];
-            out[u][v] = 0.25 * ALPHA8[u]*ALPHA8[v] * s;
+/* ========================== Options ========================== */
+// Long options may appear anywhere after the method number. They are removed
+// from argv before dispatch, so the positional argc checks below are unchanged.
+static const char* PREC_NAME[3] = { "double", "float", "int" };
+static const char* g_batch;     // --batch LIST
+
+static int strip_options(int argc, char** argv, mmsp_enc_params* o){
+    int out = 1;
+    for(int i=1;i<argc;i++){
+        if(strncmp(argv[i],"--",2)!=0){ argv[out++]=argv[i]; continue; }
+        const char* name = argv[i]+2;
+        if(strcmp(name,"progressive")==0){ o->progressive = 1; continue; }
+        if(strcmp(name,"index")==0){ o->row_index = 1; continue; }
+        if(strcmp(name,"lossless")==0){ o->lossless = 1; continue; }
+        if(strcmp(name,"dedup")==0){ o->dedup = 1; continue; }
+        if(i+1>=argc) die("option is missing its value");
+        const char* val = argv[++i];
+        if(strcmp(name,"table")==0){
+            if(strcmp(val,"optimal")==0)      o->huf_table = MMSP_TABLE_OPTIMAL;
+            else if(strcmp(val,"static")==0)  o->huf_table = MMSP_TABLE_STATIC;
+            else if(strncmp(val,"sampled",7)==0){
+                o->huf_table = MMSP_TABLE_SAMPLED;
+                if(val[7]==':') o->sample_every = atoi(val+8);
+                else if(val[7]!='\0') die("--table sampled[:N]");
+                if(o->sample_every<1) die("--table sampled:N needs N >= 1");
+            }
+            else die("--table must be optimal, static or sampled[:N]");
+        }else if(strcmp(name,"sequence")==0){
+            if(strcmp(val,"skip")==0)       o->sequence = MMSP_SEQ_SKIP;
+            else if(strcmp(val,"delta")==0) o->sequence = MMSP_SEQ_DELTA;
+            else die("--sequence must be skip or delta");
+        }else if(strcmp(name,"color")==0){
+            if(strcmp(val,"float")==0)      o->color_fixed = 0;
+            else if(strcmp(val,"fixed")==0) o->color_fixed = 1;
+            else die("--color must be float or fixed");
+        }else if(strcmp(name,"precision")==0){
+            int k=0;
+            while(k<3 && strcmp(val,PREC_NAME[k])!=0) k++;
+            if(k==3) die("--precision must be double, float or int");
+            o->precision = k;
+        }else if(strcmp(name,"threads")==0){
+            o->threads = atoi(val);
+            if(o->threads<0) die("--threads N needs N >= 0");
+        }else if(strcmp(name,"ef")==0){
+            if(strcmp(val,"float")==0) o->ef_bits = -1;
+            else if(strncmp(val,"compact",7)==0){
+                o->ef_bits = MMSP_EF_BITS_DEFAULT;
+                if(val[7]==':') o->ef_bits = atoi(val+8);
+                else if(val[7]!='\0') die("--ef compact[:K]");
+                if(o->ef_bits<0 || o->ef_bits>MMSP_EF_BITS_MAX) die("--ef compact:K needs 0 <= K <= 9");
+            }
+            else die("--ef must be float or compact[:K]");
+        }else if(strcmp(name,"lambda")==0){
+            o->lambda = atof(val);
+            if(!(o->lambda>=0)) die("--lambda L needs L >= 0");
+        }else if(strcmp(name,"batch")==0){
+            g_batch = val;
+        }else{
+            fprintf(stderr,"unknown option --%s\n", name);
+            die("bad option");
         }
     }
+    argv[out] = NULL;
+    return out;
 }
 
-static void idct8x8(const double in[8][8], double out[8][8]){
-    // temp[x][v] = sum_u alpha(u)*in[u][v]*cos(u,x)
-    double temp[8][8];
-    for(int x=0;x<8;x++){
-        for(int v=0;v<8;v++){
-            double s=0.0;
-            for(int u=0;u<8;u++) s += ALPHA8[u]*in[u][v]*COS8[u][x];
-            temp[x][v]=s;
-        }
-    }
-    // out[x][y] = 0.25 * sum_v alpha(v)*temp[x][v]*cos(v,y)
-    for(int x=0;x<8;x++){
-        for(int y=0;y<8;y++){
-            double s=0.0;
-            for(int v=0;v<8;v++) s += ALPHA8[v]*temp[x][v]*COS8[v][y];
-            out[x][y] = 0.25 * s;
+/* ========================== Files ========================== */
+static int is_stdio_path(const char* path){ return path[0]=='-' && path[1]==0; }
+
+// whole file (or stdin) in memory; NULL if it cannot be opened
+static uint8_t* read_all(const char* path, size_t* len){
+    FILE* f = is_stdio_path(path) ? stdin : fopen(path,"rb");
+    if(!f) return NULL;
+    size_t n=0, cap=1<<16;
+    uint8_t* buf = (uint8_t*)malloc(cap);
+    if(!buf) die("OOM");
+    for(size_t k; (k=fread(buf+n,1,cap-n,f))>0; ){
+        n += k;
+        if(n==cap){
+            cap *= 2;
+            buf = (uint8_t*)realloc(buf,cap);
+            if(!buf) die("OOM");
         }
     }
+    if(f!=stdin) fclose(f);
+    *len = n;
+    return buf;
 }
 
-/* ========================== Color ========================== */
-static void rgb_to_ycbcr(uint8_t R, uint8_t G, uint8_t B, double* Y, double* Cb, double* Cr){
-    // BT.601
-    *Y  =  0.299   * R + 0.587   * G + 0.114   * B;
-    *Cb = -0.168736* R - 0.331264* G + 0.5     * B + 128.0;
-    *Cr =  0.5     * R - 0.418688* G - 0.081312* B + 128.0;
+// NULL on success, else the error
+static const char* write_all(const char* path, const mmsp_buf* b){
+    FILE* f = is_stdio_path(path) ? stdout : fopen(path,"wb");
+    if(!f) return "open output failed";
+    int ok = (b->len==0 || fwrite(b->data,1,b->len,f)==b->len);
+    if(f==stdout){ if(fflush(f)!=0) ok = 0; }
+    else if(fclose(f)!=0) ok = 0;
+    return ok ? NULL : "write failed";
 }
 
-/* ========================== Quant tables ========================== */
-static const int QT_Y[8][8] = {
-    {16,11,10,16,24,40,51,61},
-    {12,12,14,19,26,58,60,55},
-    {14,13,16,24,40,57,69,56},
-    {14,17,22,29,51,87,80,62},
-    {18,22,37,56,68,109,103,77},
-    {24,35,55,64,81,104,113,92},
-    {49,64,78,87,103,121,120,101},
-    {72,92,95,98,112,100,103,99}
-};
-static const int QT_C[8][8] = {
-    {17,18,24,47,99,99,99,99},
-    {18,21,26,66,99,99,99,99},
-    {24,26,56,99,99,99,99,99},
-    {47,66,99,99,99,99,99,99},
-    {99,99,99,99,99,99,99,99},
-    {99,99,99,99,99,99,99,99},
-    {99,99,99,99,99,99,99,99},
-    {99,99,99,99,99,99,99,99}
-};
-
-static void write_qt_txt(const char* path, const int qt[8][8]){
-    FILE* f = fopen(path,"w");
-    if(!f) die("open qt txt failed");
-    for(int r=0;r<8;r++){
-        for(int c=0;c<8;c++){
-            fprintf(f,"%d%s", qt[r][c], (c==7)?"":" ");
+// Positional arguments of one encode (argv[1] method, argv[2] input.bmp); sets
+// the mode parameters and *first, the argv index of output part 0.
+// NULL if they fit the method, else a usage line or an error.
+static const char* check_args(int argc, char** argv, mmsp_enc_params* p, int* first){
+    *first = 3;
+    switch(p->method){
+    case 0:
+        if(argc!=7) return "Usage: encoder 0 input.bmp R.txt G.txt B.txt dim.txt";
+        break;
+    case 1:
+        if(argc!=13 && argc!=8){
+            return "Usage: encoder 1 input.bmp Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt qF_Y.raw qF_Cb.raw qF_Cr.raw eF_Y.raw eF_Cb.raw eF_Cr.raw\n"
+                   "       encoder 1 input.bmp Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt coef.raw";
+        }
+        p->interleaved = (argc==8);
+        break;
+    case 2:
+    case 3:
+        if(argc!=(p->method==2 ? 5 : 6)){
+            return p->method==2 ? "Usage: encoder 2 input.bmp ascii|binary rle_code"
+                                : "Usage: encoder 3 input.bmp ascii|binary codebook.txt huffman_code";
         }
-        fprintf(f,"\n");
+        p->ascii = 0;
+        if(strcmp(argv[3],"ascii")==0) p->ascii = 1;
+        else if(strcmp(argv[3],"binary")!=0) return p->method==2 ? "Method-2: third arg must be ascii or binary"
+                                                                 : "Method-3: third arg must be ascii or binary";
+        if(p->method==3 && is_stdio_path(argv[4]) && is_stdio_path(argv[5]))
+            return "Method-3: only one of codebook/huffman_code can be stdout";
+        *first = 4;
+        break;
+    default:
+        if(argc!=4) return p->method==4 ? "Usage: encoder 4 input.bmp arith_code.bin" : "Usage: encoder 5 input.bmp rans_code.bin";
+        break;
     }
-    fclose(f);
+    return NULL;
 }
 
-/* ========================== ZigZag ========================== */
-static const int ZZU[64] = {
- 0,0,1,2,1,0,0,1,2,3,4,3,2,1,0,0,
- 1,2,3,4,5,6,5,4,3,2,1,0,1,2,3,4,
- 5,6,7,7,6,5,4,3,2,3,4,5,6,7,7,6,
- 5,4,5,6,7,7,6,7,7,7,7,7,7,7,7,7
-};
-static const int ZZV[64] = {
- 0,1,0,0,1,2,3,2,1,0,0,1,2,3,4,5,
- 4,3,2,1,0,0,1,2,3,4,5,6,7,6,5,4,
- 3,2,1,0,1,2,3,4,5,6,7,7,6,5,4,3,
- 4,5,6,7,7,6,5,6,7,7,6,5,4,3,2,1
-};
-// NOTE: 這份 ZZU/ZZV 是「能跑」的順序（與 JPEG 標準同型），
-//       若你老師給的 zigzag 不同，你只要把 ZZU/ZZV 替換即可（decoder 也要同一份）。
-
-/* ========================== Method-2 RLE binary format ========================== */
-typedef struct { int16_t skip; int16_t val; } Pair;
-
-static void usage(void){
-    printf("Usage:\n");
-    printf("  encoder 0 input.bmp R.txt G.txt B.txt dim.txt\n");
-    printf("  encoder 1 input.bmp Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt qF_Y.raw qF_Cb.raw qF_Cr.raw eF_Y.raw eF_Cb.raw eF_Cr.raw\n");
-    printf("  encoder 2 input.bmp ascii  rle_code.txt\n");
-    printf("  encoder 2 input.bmp binary rle_code.bin\n");
-    printf("  encoder 3 input.bmp ascii  codebook.txt huffman_code.txt\n");
-    printf("  encoder 3 input.bmp binary codebook.txt huffman_code.bin\n");
-}
 
-/* ========================== Huffman (Method-3) ========================== */
-typedef struct HNode {
-    int is_leaf;
-    int sym;              // 0..255 if leaf
-    uint64_t freq;
-    struct HNode *l, *r;
-} HNode;
+/* ========================== Batch ==========================
+   --batch LIST: one encode per line of LIST, written as the arguments that follow
+   the method on the command line ('#' starts a comment line). Three stages run
+   concurrently, linked by two-slot queues:
+     reader  (thread)  loads image i+1 into memory
+     encoder (main)    encodes image i
+     writer  (thread)  writes the outputs of image i-1
+   Two encoder contexts alternate, so the result of one image stays valid while
+   the writer drains it and the next one is encoded. With --sequence the lines are
+   the frames of one series and share a single context (it holds the reference
+   frame), so encoding waits for the writer; reading still overlaps. Each stage
+   is a plain blocking loop; a failed job is reported and skipped, the exit
+   status is 1 (with --sequence the next frame is then a key frame, whether the
+   job failed to encode or its outputs could not be written). */
+#define BATCH_MAX_ARGS 16
+#define BATCH_SLOTS 2
 
-static HNode* hn_new_leaf(int sym, uint64_t freq){
-    HNode* n = (HNode*)calloc(1,sizeof(HNode));
-    if(!n) die("OOM");
-    n->is_leaf=1; n->sym=sym; n->freq=freq;
-    return n;
+typedef struct {
+    char* line;                 // owns the argument strings
+    int argc;
+    char* argv[BATCH_MAX_ARGS+1];
+    int first;
+    mmsp_enc_params p;
+    uint8_t* bmp;
+    size_t bmp_len;
+    int ctx;                    // encoder context holding the result
+    mmsp_result r;
+    char err[256];
+} BatchJob;
+
+// bounded FIFO of pointers; NULL marks the end of the stream
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    void* item[BATCH_SLOTS];
+    int head, count;
+} Chan;
+
+static void chan_init(Chan* c){
+    pthread_mutex_init(&c->mu, NULL);
+    pthread_cond_init(&c->cv, NULL);
+    c->head = c->count = 0;
 }
-static HNode* hn_new_internal(HNode* a, HNode* b){
-    HNode* n = (HNode*)calloc(1,sizeof(HNode));
-    if(!n) die("OOM");
-    n->is_leaf=0;
-    n->l=a; n->r=b;
-    n->freq = (a?a->freq:0) + (b?b->freq:0);
-    return n;
+static void chan_put(Chan* c, void* v){
+    pthread_mutex_lock(&c->mu);
+    while(c->count==BATCH_SLOTS) pthread_cond_wait(&c->cv, &c->mu);
+    c->item[(c->head + c->count) % BATCH_SLOTS] = v;
+    c->count++;
+    pthread_cond_broadcast(&c->cv);
+    pthread_mutex_unlock(&c->mu);
 }
-static void hn_free(HNode* n){
-    if(!n) return;
-    hn_free(n->l); hn_free(n->r);
-    free(n);
+static void* chan_get(Chan* c){
+    pthread_mutex_lock(&c->mu);
+    while(c->count==0) pthread_cond_wait(&c->cv, &c->mu);
+    void* v = c->item[c->head];
+    c->head = (c->head + 1) % BATCH_SLOTS;
+    c->count--;
+    pthread_cond_broadcast(&c->cv);
+    pthread_mutex_unlock(&c->mu);
+    return v;
 }
 
-// deterministic compare: (freq, is_leaf, sym/minSym)
 typedef struct {
-    HNode** a;
-    int sz, cap;
-} MinHeap;
-
-static int min_sym(HNode* n){
-    if(!n) return 999999;
-    if(n->is_leaf) return n->sym;
-    int ml = min_sym(n->l);
-    int mr = min_sym(n->r);
-    return (ml<mr)?ml:mr;
-}
-
-static int hn_less(HNode* x, HNode* y){
-    if(x->freq != y->freq) return x->freq < y->freq;
-    int mx = min_sym(x), my = min_sym(y);
-    if(mx != my) return mx < my;
-    // tie: leaf first
-    if(x->is_leaf != y->is_leaf) return x->is_leaf > y->is_leaf;
-    return 0;
-}
-
-static void heap_init(MinHeap* h, int cap){
-    h->a = (HNode**)malloc(sizeof(HNode*)*cap);
-    if(!h->a) die("OOM");
-    h->sz=0; h->cap=cap;
-}
-static void heap_push(MinHeap* h, HNode* n){
-    if(h->sz >= h->cap){
-        h->cap *= 2;
-        h->a = (HNode**)realloc(h->a, sizeof(HNode*)*h->cap);
-        if(!h->a) die("OOM");
-    }
-    int i = h->sz++;
-    h->a[i]=n;
-    while(i>0){
-        int p=(i-1)/2;
-        if(!hn_less(h->a[i], h->a[p])) break;
-        HNode* tmp=h->a[i]; h->a[i]=h->a[p]; h->a[p]=tmp;
-        i=p;
-    }
-}
-static HNode* heap_pop(MinHeap* h){
-    if(h->sz==0) return NULL;
-    HNode* ret=h->a[0];
-    h->a[0]=h->a[--h->sz];
-    int i=0;
-    while(1){
-        int l=i*2+1, r=i*2+2, m=i;
-        if(l<h->sz && hn_less(h->a[l], h->a[m])) m=l;
-        if(r<h->sz && hn_less(h->a[r], h->a[m])) m=r;
-        if(m==i) break;
-        HNode* tmp=h->a[i]; h->a[i]=h->a[m]; h->a[m]=tmp;
-        i=m;
+    FILE* list;
+    char* line;                 // getline buffer (reader thread): job lines have no length limit
+    size_t line_cap;
+    mmsp_enc_params p;          // options shared by every job
+    Chan loaded, encoded, free_ctx;
+    int jobs, failed;           // writer's counts
+    int seq_reset;              // --sequence: a frame was not written, the next one is a key
+                                // frame (set by the writer before it releases the context)
+} Batch;
+
+static BatchJob* batch_next_job(Batch* b){
+    while(getline(&b->line, &b->line_cap, b->list) != -1){
+        char* s = b->line;
+        while(*s==' ' || *s=='\t') s++;
+        if(*s=='\0' || *s=='\n' || *s=='\r' || *s=='#') continue;
+        BatchJob* j = (BatchJob*)calloc(1, sizeof(BatchJob));
+        if(!j || !(j->line = strdup(s))) die("OOM");
+        j->argv[j->argc++] = "encoder";
+        j->argv[j->argc++] = "";
+        for(char* t = strtok(j->line, " \t\r\n"); t; t = strtok(NULL, " \t\r\n")){
+            if(j->argc==BATCH_MAX_ARGS){ snprintf(j->err, sizeof(j->err), "too many arguments"); break; }
+            j->argv[j->argc++] = t;
+        }
+        j->p = b->p;
+        if(!j->err[0]){
+            const char* msg = check_args(j->argc, j->argv, &j->p, &j->first);
+            if(msg) snprintf(j->err, sizeof(j->err), "%s", msg);
+        }
+        for(int k=2;k<j->argc && !j->err[0];k++)
+            if(is_stdio_path(j->argv[k])) snprintf(j->err, sizeof(j->err), "--batch jobs read and write files, not -");
+        return j;
     }
-    return ret;
+    return NULL;
 }
 
-static HNode* build_huffman(uint64_t freq[256], int* unique_out){
-    MinHeap hp; heap_init(&hp, 256);
-    int unique=0;
-    for(int s=0;s<256;s++){
-        if(freq[s]>0){
-            heap_push(&hp, hn_new_leaf(s, freq[s]));
-            unique++;
+static void* batch_reader(void* arg){
+    Batch* b = (Batch*)arg;
+    BatchJob* j;
+    while((j = batch_next_job(b))){
+        if(!j->err[0]){
+            j->bmp = read_all(j->argv[2], &j->bmp_len);
+            if(!j->bmp) snprintf(j->err, sizeof(j->err), "open %s failed", j->argv[2]);
         }
+        chan_put(&b->loaded, j);
     }
-    if(unique==0) die("empty payload for Huffman");
-    if(unique==1){
-        // special: create dummy internal node
-        HNode* only = heap_pop(&hp);
-        HNode* dummy = hn_new_leaf((only->sym==0)?1:0, 0);
-        HNode* root = hn_new_internal(dummy, only);
-        *unique_out=unique;
-        free(hp.a);
-        return root;
-    }
-    while(hp.sz>1){
-        HNode* a = heap_pop(&hp);
-        HNode* b = heap_pop(&hp);
-        // deterministic: ensure left is "smaller"
-        if(hn_less(b,a)){ HNode* t=a; a=b; b=t; }
-        heap_push(&hp, hn_new_internal(a,b));
-    }
-    HNode* root = heap_pop(&hp);
-    free(hp.a);
-    *unique_out=unique;
-    return root;
+    chan_put(&b->loaded, NULL);
+    return NULL;
 }
 
-static void gen_codes(HNode* n, char* buf, int depth, char* codes[256]){
-    if(!n) return;
-    if(n->is_leaf){
-        buf[depth]='\0';
-        codes[n->sym] = strdup(buf[0]?buf:"0"); // if only one symbol, code "0"
-        return;
+static void* batch_writer(void* arg){
+    Batch* b = (Batch*)arg;
+    BatchJob* j;
+    while((j = (BatchJob*)chan_get(&b->encoded))){
+        for(int k=0;k<j->r.nparts && !j->err[0];k++){
+            const char* msg = write_all(j->argv[j->first+k], &j->r.part[k]);
+            if(msg) snprintf(j->err, sizeof(j->err), "%s: %s", j->argv[j->first+k], msg);
+        }
+        if(j->err[0]){
+            fprintf(stderr, "ERROR: %s: %s\n", j->argc>2 ? j->argv[2] : "?", j->err);
+            b->failed++;
+            if(j->ctx>=0 && j->p.sequence) b->seq_reset = 1;
+        }else if(j->r.report.len){
+            printf("== %s\n", j->argv[2]);
+            fwrite(j->r.report.data, 1, j->r.report.len, stdout);
+        }
+        b->jobs++;
+        if(j->ctx>=0) chan_put(&b->free_ctx, (void*)(intptr_t)(j->ctx+1));
+        free(j->line);
+        free(j);
     }
-    buf[depth]='0'; gen_codes(n->l, buf, depth+1, codes);
-    buf[depth]='1'; gen_codes(n->r, buf, depth+1, codes);
+    return NULL;
 }
 
-/* pack bits MSB-first */
-typedef struct {
-    uint8_t* data;
-    size_t bit_len;
-    size_t cap;
-} BitBuf;
-
-static void bitbuf_init(BitBuf* b){
-    b->cap = 1024;
-    b->data = (uint8_t*)calloc(b->cap,1);
-    if(!b->data) die("OOM");
-    b->bit_len=0;
-}
-static void bitbuf_push_bit(BitBuf* b, int bit){
-    size_t byte = b->bit_len / 8;
-    size_t off  = b->bit_len % 8;
-    if(byte >= b->cap){
-        size_t old = b->cap;
-        b->cap *= 2;
-        b->data = (uint8_t*)realloc(b->data, b->cap);
-        if(!b->data) die("OOM");
-        memset(b->data+old, 0, b->cap-old);
+static int run_batch(const mmsp_enc_params* p){
+    Batch b;
+    memset(&b, 0, sizeof(b));
+    b.p = *p;
+    b.list = is_stdio_path(g_batch) ? stdin : fopen(g_batch, "r");
+    if(!b.list) die("open --batch list failed");
+    chan_init(&b.loaded);
+    chan_init(&b.encoded);
+    chan_init(&b.free_ctx);
+
+    mmsp_encoder* enc[BATCH_SLOTS];
+    int nctx = p->sequence ? 1 : BATCH_SLOTS;
+    for(int k=0;k<nctx;k++){
+        enc[k] = mmsp_encoder_create();
+        if(!enc[k]) die("OOM");
+        chan_put(&b.free_ctx, (void*)(intptr_t)(k+1)); // +1: NULL ends a channel
     }
-    if(bit) b->data[byte] |= (uint8_t)(1u << (7-off));
-    b->bit_len++;
-}
-static void bitbuf_push_code(BitBuf* b, const char* code){
-    for(const char* p=code; *p; p++){
-        bitbuf_push_bit(b, (*p=='1'));
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t reader, writer;
+    if(pthread_create(&reader, NULL, batch_reader, &b)!=0 ||
+       pthread_create(&writer, NULL, batch_writer, &b)!=0) die("pthread_create failed");
+
+    BatchJob* j;
+    while((j = (BatchJob*)chan_get(&b.loaded))){
+        j->ctx = -1;
+        if(!j->err[0]){
+            j->ctx = (int)(intptr_t)chan_get(&b.free_ctx) - 1; // waits for the writer to release one
+            if(b.seq_reset){ mmsp_encoder_seq_reset(enc[j->ctx]); b.seq_reset = 0; }
+            if(mmsp_encode(enc[j->ctx], &j->p, j->bmp, j->bmp_len, &j->r)!=MMSP_OK)
+                snprintf(j->err, sizeof(j->err), "%s", mmsp_encoder_error(enc[j->ctx]));
+        }
+        free(j->bmp);
+        j->bmp = NULL;
+        chan_put(&b.encoded, j);
     }
+    chan_put(&b.encoded, NULL);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    for(int k=0;k<nctx;k++) mmsp_encoder_destroy(enc[k]);
+    free(b.line);
+    if(b.list!=stdin) fclose(b.list);
+    fprintf(stderr, "batch: %d jobs, %d failed, %.3f s\n", b.jobs, b.failed,
+            (double)(t1.tv_sec-t0.tv_sec) + (double)(t1.tv_nsec-t0.tv_nsec)*1e-9);
+    return b.failed ? 1 : 0;
 }
 
 /* ========================== MAIN ========================== */
 int main(int argc, char** argv){
+    mmsp_enc_params p;
+    mmsp_enc_params_init(&p);
     if(argc < 2){ usage(); return 1; }
-    int method = atoi(argv[1]);
-
-    init_dct_table();
-
-    /* ------------------ Method 0 ------------------ */
-    if(method==0){
-        if(argc!=7){
-            printf("Usage: encoder 0 input.bmp R.txt G.txt B.txt dim.txt\n");
-            return 1;
-        }
-        const char* bmp = argv[2];
-        int W,H, has54=0; uint8_t hdr54[54];
-        uint8_t *R,*G,*B;
-        load_bmp_topdown_rgb(bmp,&W,&H,&R,&G,&B,hdr54,&has54);
-
-        FILE* fr=fopen(argv[3],"w");
-        FILE* fg=fopen(argv[4],"w");
-        FILE* fb=fopen(argv[5],"w");
-        FILE* fd=fopen(argv[6],"w");
-        if(!fr||!fg||!fb||!fd) die("open output failed");
-
-        // dim.txt: first line W H, second line optional HDR54 hex
-        fprintf(fd,"%d %d\n",W,H);
-        if(has54){
-            fprintf(fd,"HDR54 ");
-            for(int i=0;i<54;i++) fprintf(fd,"%02X", hdr54[i]);
-            fprintf(fd,"\n");
-        }
-
-        for(int y=0;y<H;y++){
-            for(int x=0;x<W;x++){
-                fprintf(fr,"%u%s", R[y*W+x], (x==W-1)?"":" ");
-                fprintf(fg,"%u%s", G[y*W+x], (x==W-1)?"":" ");
-                fprintf(fb,"%u%s", B[y*W+x], (x==W-1)?"":" ");
-            }
-            fprintf(fr,"\n"); fprintf(fg,"\n"); fprintf(fb,"\n");
-        }
+    argc = strip_options(argc, argv, &p);
+    if(argc < 2){ usage(); return 1; }
+    p.method = atoi(argv[1]);
+    if(p.method<0 || p.method>5){ usage(); return 1; }
 
-        fclose(fr); fclose(fg); fclose(fb); fclose(fd);
-        free(R); free(G); free(B);
-        return 0;
+    if(g_batch){
+        if(argc!=2){ printf("Usage: encoder N --batch jobs.txt [options]\n"); return 1; }
+        return run_batch(&p);
     }
 
-    /* ------------------ Method 1 ------------------ */
-    if(method==1){
-        if(argc!=13){
-            printf("Usage: encoder 1 input.bmp Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt qF_Y.raw qF_Cb.raw qF_Cr.raw eF_Y.raw eF_Cb.raw eF_Cr.raw\n");
-            return 1;
-        }
-        const char* bmp=argv[2];
-        const char* qtY=argv[3];
-        const char* qtCb=argv[4];
-        const char* qtCr=argv[5];
-        const char* dim=argv[6];
-        const char* qFY=argv[7];
-        const char* qFCb=argv[8];
-        const char* qFCr=argv[9];
-        const char* eFY=argv[10];
-        const char* eFCb=argv[11];
-        const char* eFCr=argv[12];
-
-        // write QTs
-        write_qt_txt(qtY, QT_Y);
-        write_qt_txt(qtCb, QT_C);
-        write_qt_txt(qtCr, QT_C);
-
-        int W,H, has54=0; uint8_t hdr54[54];
-        uint8_t *R,*G,*B;
-        load_bmp_topdown_rgb(bmp,&W,&H,&R,&G,&B,hdr54,&has54);
-
-        FILE* fd=fopen(dim,"w"); if(!fd) die("open dim failed");
-        fprintf(fd,"%d %d\n",W,H);
-        if(has54){
-            fprintf(fd,"HDR54 ");
-            for(int i=0;i<54;i++) fprintf(fd,"%02X", hdr54[i]);
-            fprintf(fd,"\n");
-        }
-        fclose(fd);
-
-        FILE* fqY=fopen(qFY,"wb");
-        FILE* fqCb=fopen(qFCb,"wb");
-        FILE* fqCr=fopen(qFCr,"wb");
-        FILE* feY=fopen(eFY,"wb");
-        FILE* feCb=fopen(eFCb,"wb");
-        FILE* feCr=fopen(eFCr,"wb");
-        if(!fqY||!fqCb||!fqCr||!feY||!feCb||!feCr) die("open raw failed");
-
-        int bw=(W+7)/8, bh=(H+7)/8;
-
-        double sig[3][8][8]={0}, noi[3][8][8]={0};
-
-        for(int by=0; by<bh; by++){
-            for(int bx=0; bx<bw; bx++){
-                double blk[3][8][8], F[3][8][8];
-
-                for(int i=0;i<8;i++){
-                    for(int j=0;j<8;j++){
-                        int y = by*8+i; if(y>=H) y=H-1;
-                        int x = bx*8+j; if(x>=W) x=W-1;
-                        double Yv,Cbv,Crv;
-                        rgb_to_ycbcr(R[y*W+x],G[y*W+x],B[y*W+x],&Yv,&Cbv,&Crv);
-                        blk[0][i][j]=Yv-128.0;
-                        blk[1][i][j]=Cbv-128.0;
-                        blk[2][i][j]=Crv-128.0;
-                    }
-                }
-
-                for(int c=0;c<3;c++) dct8x8(blk[c], F[c]);
-
-                for(int u=0;u<8;u++){
-                    for(int v=0;v<8;v++){
-                        // Y
-                        {
-                            double q = (double)QT_Y[u][v];
-                            double f = F[0][u][v];
-                            int16_t qi = (int16_t)llround(f/q);
-                            float   ei = (float)(f - (double)qi*q);
-                            fwrite(&qi, sizeof(int16_t), 1, fqY);
-                            fwrite(&ei, sizeof(float),   1, feY);
-                            sig[0][u][v]+=f*f;
-                            noi[0][u][v]+=(double)ei*(double)ei;
-                        }
-                        // Cb
-                        {
-                            double q = (double)QT_C[u][v];
-                            double f = F[1][u][v];
-                            int16_t qi = (int16_t)llround(f/q);
-                            float   ei = (float)(f - (double)qi*q);
-                            fwrite(&qi, sizeof(int16_t), 1, fqCb);
-                            fwrite(&ei, sizeof(float),   1, feCb);
-                            sig[1][u][v]+=f*f;
-                            noi[1][u][v]+=(double)ei*(double)ei;
-                        }
-                        // Cr
-                        {
-                            double q = (double)QT_C[u][v];
-                            double f = F[2][u][v];
-                            int16_t qi = (int16_t)llround(f/q);
-                            float   ei = (float)(f - (double)qi*q);
-                            fwrite(&qi, sizeof(int16_t), 1, fqCr);
-                            fwrite(&ei, sizeof(float),   1, feCr);
-                            sig[2][u][v]+=f*f;
-                            noi[2][u][v]+=(double)ei*(double)ei;
-                        }
-                    }
-                }
-            }
-        }
-
-        fclose(fqY); fclose(fqCb); fclose(fqCr);
-        fclose(feY); fclose(feCb); fclose(feCr);
-        free(R); free(G); free(B);
-
-        // print SQNR_Freq 3x64
-        printf("SQNR_Freq (dB) 3x64 (Y Cb Cr), order u=0..7 v=0..7\n");
-        const char* names[3]={"Y","Cb","Cr"};
-        for(int c=0;c<3;c++){
-            printf("%s:\n", names[c]);
-            for(int u=0;u<8;u++){
-                for(int v=0;v<8;v++){
-                    if(noi[c][u][v]<=0) printf("INF");
-                    else printf("%.6f", 10.0*log10(sig[c][u][v]/noi[c][u][v]));
-                    if(!(u==7 && v==7)) printf(" ");
-                }
-            }
-            printf("\n");
-        }
-        return 0;
+    int first;
+    const char* msg = check_args(argc, argv, &p, &first);
+    if(msg){
+        if(strncmp(msg,"Usage",5)!=0) die(msg);
+        printf("%s\n", msg);
+        return 1;
     }
 
-    /* ------------------ Method 2 (RLE) ------------------ */
-    if(method==2){
-        if(argc!=5){
-            printf("Usage: encoder 2 input.bmp ascii|binary rle_code\n");
-            return 1;
-        }
-        const char* bmp=argv[2];
-        const int is_ascii = (strcmp(argv[3],"ascii")==0);
-        const int is_bin   = (strcmp(argv[3],"binary")==0);
-        if(!is_ascii && !is_bin) die("Method-2: third arg must be ascii or binary");
-
-        int W,H, has54=0; uint8_t hdr54[54];
-        uint8_t *R,*G,*B;
-        load_bmp_topdown_rgb(bmp,&W,&H,&R,&G,&B,hdr54,&has54);
-
-        FILE* out = fopen(argv[4], is_ascii? "w":"wb");
-        if(!out) die("open rle output failed");
-
-        int bw=(W+7)/8, bh=(H+7)/8;
-
-        if(is_ascii){
-            fprintf(out,"%d %d\n", W, H);
-        }else{
-            // binary header: "M2B0" + W,H (int32) + bw,bh (int32)
-            fwrite("M2B0",1,4,out);
-            int32_t iW=W,iH=H, iBW=bw, iBH=bh;
-            fwrite(&iW,4,1,out); fwrite(&iH,4,1,out);
-            fwrite(&iBW,4,1,out); fwrite(&iBH,4,1,out);
-        }
-
-        int16_t prevDC[3]={0,0,0};
-
-        for(int m=0;m<bh;m++){
-            for(int n=0;n<bw;n++){
-                double blk[3][8][8], F[3][8][8];
-                int16_t q[3][8][8];
-
-                // build block (top-down), level shift
-                for(int i=0;i<8;i++){
-                    for(int j=0;j<8;j++){
-                        int y=m*8+i; if(y>=H) y=H-1;
-                        int x=n*8+j; if(x>=W) x=W-1;
-                        double Yv,Cbv,Crv;
-                        rgb_to_ycbcr(R[y*W+x],G[y*W+x],B[y*W+x],&Yv,&Cbv,&Crv);
-                        blk[0][i][j]=Yv-128.0;
-                        blk[1][i][j]=Cbv-128.0;
-                        blk[2][i][j]=Crv-128.0;
-                    }
-                }
-
-                for(int c=0;c<3;c++){
-                    dct8x8(blk[c], F[c]);
-                    for(int u=0;u<8;u++){
-                        for(int v=0;v<8;v++){
-                            double Q = (c==0)? (double)QT_Y[u][v] : (double)QT_C[u][v];
-                            q[c][u][v] = (int16_t)llround(F[c][u][v]/Q);
-                        }
-                    }
-                }
-
-                // per channel: DPCM on DC then ZigZag + RLE
-                for(int c=0;c<3;c++){
-                    // collect 64 coefficients in zigzag order
-                    int16_t zz[64];
-                    for(int k=0;k<64;k++){
-                        int u=ZZU[k], v=ZZV[k];
-                        zz[k]=q[c][u][v];
-                    }
-                    // DPCM DC
-                    int16_t dc = zz[0];
-                    int16_t diff = (int16_t)(dc - prevDC[c]);
-                    prevDC[c] = dc;
-                    zz[0] = diff;
-
-                    // RLE pairs for NONZERO, store as (skip,val) with "skip:val" in ascii to match你現在的 rle_code.txt
-                    Pair pairs[256];
-                    int pc=0;
-                    int zc=0;
-                    for(int k=0;k<64;k++){
-                        int16_t v = zz[k];
-                        if(v==0) zc++;
-                        else {
-                            pairs[pc].skip = (int16_t)zc;
-                            pairs[pc].val  = v;
-                            pc++;
-                            zc=0;
-                        }
-                    }
-
-                    if(is_ascii){
-                        const char* ch = (c==0)?"Y":(c==1)?"Cb":"Cr";
-                        fprintf(out,"(%d,%d,%s)", m,n,ch);
-                        for(int i=0;i<pc;i++){
-                            fprintf(out," %d:%d", (int)pairs[i].skip, (int)pairs[i].val);
-                        }
-                        fprintf(out,"\n");
-                    }else{
-                        // binary record: uint16 pc, then pc*(int16 skip, int16 val)
-                        uint16_t upc = (uint16_t)pc;
-                        fwrite(&upc,2,1,out);
-                        fwrite(pairs,sizeof(Pair),(size_t)pc,out);
-                    }
-                }
-            }
-        }
-
-        fclose(out);
-        free(R); free(G); free(B);
-        return 0;
-    }
-
-    /* ------------------ Method 3 (Huffman over Method2-binary payload) ------------------ */
-    if(method==3){
-        if(argc!=6){
-            printf("Usage: encoder 3 input.bmp ascii|binary codebook.txt huffman_code\n");
-            return 1;
-        }
-        const char* bmp=argv[2];
-        const int is_ascii = (strcmp(argv[3],"ascii")==0);
-        const int is_bin   = (strcmp(argv[3],"binary")==0);
-        if(!is_ascii && !is_bin) die("Method-3: third arg must be ascii or binary");
-        const char* codebook_path = argv[4];
-        const char* huf_path = argv[5];
-
-        // Step1: Generate Method-2 binary payload in memory buffer by reusing Method-2 encode logic,
-        //        but write into temp file then read back. (keeps encoder single-file; simplest)
-        const char* tmp_m2 = "__m2_tmp_payload.bin";
-        {
-            char* argv2[] = { argv[0], "2", (char*)bmp, "binary", (char*)tmp_m2 };
-            // call our method2 branch by simulating; easiest: spawn re-run not possible, so just re-enter:
-            // We will just run the method2 code by calling main recursively is bad.
-            // So we implement minimal: call system on Windows is allowed but not ideal.
-            // For robustness, we require user to run method2 first if you really want no temp.
-            // However assignment expects method3 standalone. We'll do a local re-run via system:
-            char cmd[2048];
-            snprintf(cmd,sizeof(cmd), "encoder 2 \"%s\" binary \"%s\"", bmp, tmp_m2);
-            int rc = system(cmd);
-            if(rc!=0) die("Method-3: failed to invoke method2 encoder (system call). Please run: encoder 2 input.bmp binary rle_code.bin first.");
-        }
-
-        // read payload bytes
-        FILE* fp = fopen(tmp_m2,"rb");
-        if(!fp) die("Method-3: open tmp payload failed");
-        fseek(fp,0,SEEK_END);
-        long sz = ftell(fp);
-        if(sz<=0) die("Method-3: empty payload");
-        fseek(fp,0,SEEK_SET);
-        uint8_t* payload = (uint8_t*)malloc((size_t)sz);
-        if(!payload) die("OOM");
-        if(fread(payload,1,(size_t)sz,fp)!=(size_t)sz) die("payload read failed");
-        fclose(fp);
-        remove(tmp_m2);
-
-        uint64_t freq[256]={0};
-        for(long i=0;i<sz;i++) freq[payload[i]]++;
-
-        int unique=0;
-        HNode* root = build_huffman(freq, &unique);
-
-        char* codes[256]={0};
-        char buf[512];
-        gen_codes(root, buf, 0, codes);
-
-        // write codebook (your format)
-        FILE* fc = fopen(codebook_path,"w");
-        if(!fc) die("open codebook failed");
-        fprintf(fc,"M3_BYTE_HUFFMAN\n");
-        fprintf(fc,"payload_size %ld\n", sz);
-        fprintf(fc,"unique %d\n", unique);
-        for(int s=0;s<256;s++){
-            if(freq[s]>0){
-                fprintf(fc,"%d %llu %s\n", s, (unsigned long long)freq[s], codes[s]);
-            }
-        }
-        fclose(fc);
-
-        // encode bitstream
-        BitBuf bb; bitbuf_init(&bb);
-        for(long i=0;i<sz;i++){
-            bitbuf_push_code(&bb, codes[payload[i]]);
-        }
-        int padbits = (int)((8 - (bb.bit_len % 8)) % 8);
-        // (already 0-filled due to calloc/realloc memset)
-
-        if(is_ascii){
-            FILE* fh = fopen(huf_path,"w");
-            if(!fh) die("open huffman_code.txt failed");
-            fprintf(fh,"M3\n");
-            fprintf(fh,"payload_size %ld\n", sz);
-            fprintf(fh,"padbits %d\n", padbits);
-            // print bits as lines (80 chars/line)
-            size_t total_bits = bb.bit_len;
-            size_t printed=0;
-            while(printed<total_bits){
-                size_t line = (total_bits-printed>80)?80:(total_bits-printed);
-                for(size_t k=0;k<line;k++){
-                    size_t idx = printed+k;
-                    uint8_t byte = bb.data[idx/8];
-                    int bit = (byte >> (7-(idx%8))) & 1;
-                    fputc(bit?'1':'0', fh);
-                }
-                fputc('\n', fh);
-                printed += line;
-            }
-            fclose(fh);
-        }else{
-            FILE* fh = fopen(huf_path,"wb");
-            if(!fh) die("open huffman_code.bin failed");
-            // binary header: "M3B0" + payload_size(u32) + padbits(u8) + bit_bytes(u32) + data
-            fwrite("M3B0",1,4,fh);
-            uint32_t psz = (uint32_t)sz;
-            uint8_t  pb  = (uint8_t)padbits;
-            uint32_t bit_bytes = (uint32_t)((bb.bit_len + 7)/8);
-            fwrite(&psz,4,1,fh);
-            fwrite(&pb,1,1,fh);
-            fwrite(&bit_bytes,4,1,fh);
-            fwrite(bb.data,1,bit_bytes,fh);
-            fclose(fh);
-        }
-
-        // cleanup
-        for(int s=0;s<256;s++) free(codes[s]);
-        hn_free(root);
-        free(bb.data);
-        free(payload);
-
-        return 0;
+    size_t bmp_len=0;
+    uint8_t* bmp = read_all(argv[2], &bmp_len);
+    if(!bmp) die("Failed to open BMP");
+
+    mmsp_encoder* enc = mmsp_encoder_create();
+    if(!enc) die("OOM");
+    mmsp_result r;
+    if(mmsp_encode(enc, &p, bmp, bmp_len, &r)!=MMSP_OK) die(mmsp_encoder_error(enc));
+
+    // outputs in part order: Method 3 finishes codebook.txt before the stream starts
+    int to_stdout = 0;
+    for(int k=0;k<r.nparts;k++){
+        const char* err = write_all(argv[first+k], &r.part[k]);
+        if(err) die(err);
+        to_stdout |= is_stdio_path(argv[first+k]);
     }
+    // keep a streamed output on stdout clean
+    if(r.report.len) fwrite(r.report.data, 1, r.report.len, to_stdout ? stderr : stdout);
 
-    usage();
-    return 1;
+    mmsp_encoder_destroy(enc);
+    free(bmp);
+    return 0;
 }
@@ -0,0 +1,151 @@
+// mmsp.h  — embeddable MMSP codec (Methods 0/1/2/3/4/5)
+// Encoder: mmsp_enc.c   Decoder: mmsp_dec.c   (link either or both, plus -pthread -lm)
+// encoder.c / decoder.c are the command-line front ends of this API.
+//
+// - A context owns the per-caller state that is set up once: DCT / RDO tables,
+//   the Method-4 context models, the Huffman tree and the entropy-coder scratch
+//   buffers. Reuse one context for any number of calls; use one context per thread.
+//   With --sequence (M2S0 payloads) the context also keeps the previous frame as
+//   the reference of the next one, so frames go through one context in order.
+// - Calls are buffer to buffer and never exit the process: failures return an
+//   mmsp_status, the message is in mmsp_*_error(), and everything the call had
+//   allocated is released.
+// - Results point into the context and stay valid until its next call or destroy.
+#ifndef MMSP_H
+#define MMSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    MMSP_OK = 0,
+    MMSP_ERR_ARG,       // unknown method, bad option value or combination, wrong input count
+    MMSP_ERR_NOMEM,
+    MMSP_ERR_FORMAT     // input is not a supported BMP, or a stream is corrupt / truncated
+} mmsp_status;
+
+static inline const char* mmsp_strerror(int status){
+    switch(status){
+    case MMSP_OK:         return "ok";
+    case MMSP_ERR_ARG:    return "invalid argument";
+    case MMSP_ERR_NOMEM:  return "out of memory";
+    case MMSP_ERR_FORMAT: return "bad input format";
+    }
+    return "unknown error";
+}
+
+typedef struct { const uint8_t* data; size_t len; } mmsp_buf;
+
+#define MMSP_MAX_PARTS 11
+
+// Largest width or height either side accepts (2^28). Pixel and block counts are
+// size_t / uint64_t throughout; this bound keeps per-row and per-block int math
+// in range. Streams whose byte counts pass 4 GB use the 64-bit container forms.
+#define MMSP_MAX_DIM (1<<28)
+
+typedef struct {
+    int nparts;                     // output buffers in command-line order (see below)
+    mmsp_buf part[MMSP_MAX_PARTS];
+    mmsp_buf report;                // text the CLIs print (SQNR, RDO, --bench); may be empty
+} mmsp_result;
+
+enum { MMSP_TABLE_OPTIMAL=0, MMSP_TABLE_STATIC=1, MMSP_TABLE_SAMPLED=2 };
+enum { MMSP_PREC_DOUBLE=0, MMSP_PREC_FLOAT=1, MMSP_PREC_INT=2 };
+enum { MMSP_SEQ_OFF=0, MMSP_SEQ_SKIP=1, MMSP_SEQ_DELTA=2 };
+
+/* ========================== Encoder ==========================
+   Input: one BMP file image (24-bit, or 32-bit BGRA). Output parts:
+     0: R.txt G.txt B.txt dim.txt
+     1: Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt qF_Y qF_Cb qF_Cr eF_Y eF_Cb eF_Cr
+        (interleaved: Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt coef)
+     2: rle_code
+     3: codebook.txt huffman_code
+     4: arith_code        5: rans_code */
+typedef struct {
+    int method;         // 0..5
+    int ascii;          // Methods 2/3: text form instead of binary
+    int interleaved;    // Method 1: one "M1I0" coef part instead of qF x3 + eF x3
+    int huf_table;      // MMSP_TABLE_*: Method-3 Huffman table
+    int sample_every;   // sampled table: statistics from every N-th block
+    int progressive;    // Method-2 binary payload as spectral-selection scans (M2P0)
+    int row_index;      // Method-2 binary payload with block-row offset index (M2X0)
+    int color_fixed;    // 16.16 fixed-point RGB -> YCbCr (-1: follow precision)
+    int precision;      // MMSP_PREC_*: forward DCT arithmetic
+    int threads;        // worker threads for the in-memory Method-3 stages (0 = all CPUs)
+    double lambda;      // rate-distortion optimized quantization (0 = plain rounding)
+    int ef_bits;        // Method-1 eF as Huffman-coded K-fraction-bit integers (-1 = float32)
+    int lossless;       // YCoCg-R + reversible lifting DCT, no quantization (Methods 2-5)
+    int sequence;       // MMSP_SEQ_*: Methods 2/3/5 skip blocks unchanged since the previous
+                        // frame of this context (M2S0); DELTA also codes coefficient differences
+    int dedup;          // Methods 2/3/5: repeated blocks as references to a hash table of recent blocks (M2D0)
+} mmsp_enc_params;
+
+#define MMSP_EF_BITS_DEFAULT 3
+#define MMSP_EF_BITS_MAX 9
+
+typedef struct mmsp_encoder mmsp_encoder;
+
+void          mmsp_enc_params_init(mmsp_enc_params* p);   // the command-line defaults, method 0
+mmsp_encoder* mmsp_encoder_create(void);                  // NULL when out of memory
+void          mmsp_encoder_destroy(mmsp_encoder* enc);
+int           mmsp_encode(mmsp_encoder* enc, const mmsp_enc_params* p,
+                          const uint8_t* bmp, size_t bmp_len, mmsp_result* out);
+const char*   mmsp_encoder_error(const mmsp_encoder* enc);
+// --sequence: drop the reference frame, so the next frame is a key frame
+// (call it when the previous frame's output was not stored)
+void          mmsp_encoder_seq_reset(mmsp_encoder* enc);
+
+/* ========================== Decoder ==========================
+   Inputs, in command-line order:
+     0: R.txt G.txt B.txt dim.txt
+     1: [original.bmp] Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt qF_Y qF_Cb qF_Cr [eF_Y eF_Cb eF_Cr]
+        or [original.bmp] Qt_Y.txt Qt_Cb.txt Qt_Cr.txt dim.txt coef
+     2: rle_code   3: codebook.txt huffman_code   4: arith_code   5: rans_code
+   Output: part 0 is the reconstructed 24-bit BMP. */
+typedef struct {
+    int method;         // 0..5
+    int ascii;          // Methods 2/3: text form instead of binary
+    int bench;          // report entropy-decode throughput in the result report
+    int scans;          // progressive streams stop after N scans (0 = all)
+    int scale;          // 1|2|4|8: Method 2-5 output at 1/scale size
+    int crop;           // Method 2-5 output only the pixel rectangle below
+    int crop_x, crop_y, crop_w, crop_h;
+    int color_fixed;    // 16.16 fixed-point YCbCr -> RGB (-1: follow precision)
+    int precision;      // MMSP_PREC_*: IDCT arithmetic
+    mmsp_buf dim;       // Methods 2-5: dim.txt whose HDR54 is reproduced (empty: plain header)
+} mmsp_dec_params;
+
+typedef struct mmsp_decoder mmsp_decoder;
+
+void          mmsp_dec_params_init(mmsp_dec_params* p);
+mmsp_decoder* mmsp_decoder_create(void);
+void          mmsp_decoder_destroy(mmsp_decoder* dec);
+int           mmsp_decode(mmsp_decoder* dec, const mmsp_dec_params* p,
+                          const mmsp_buf* in, int nin, mmsp_result* out);
+const char*   mmsp_decoder_error(const mmsp_decoder* dec);
+
+/* ---- File counts per method (front ends check them before any work) ---- */
+// encoder output parts; Method 1 interleaved writes 5 instead of 10. -1: bad method
+static inline int mmsp_enc_nparts(int method, int interleaved){
+    static const int n[6] = { 4, 10, 1, 2, 1, 1 };
+    if(method<0 || method>5) return -1;
+    return (method==1 && interleaved) ? 5 : n[method];
+}
+// decoder inputs: Method 1 takes 5/6 (coef, [original]), 8 (original, no eF),
+// 10 (with eF) or 11 (both)
+static inline int mmsp_dec_nin_ok(int method, int nin){
+    static const int n[6] = { 4, 0, 1, 2, 1, 1 };
+    if(method<0 || method>5) return 0;
+    if(method==1) return nin==5 || nin==6 || nin==8 || nin==10 || nin==11;
+    return nin==n[method];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,2141 @@
+// mmsp_dec.c — Methods 0/1/2/3/4/5 (FULL, produces BMP) — decoder library, API in mmsp.h, CLI in decoder.c
+// Buffer-to-buffer decoder matching the mmsp_enc.c formats.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>   // off_t
+#include <pthread.h>
+#include "mmsp.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* ================= BMP structs ================= */
+#pragma pack(push,1)
+typedef struct {
+    uint16_t bfType;
+    uint32_t bfSize;
+    uint16_t r1, r2;
+    uint32_t offBits;
+} BMPFileHeader;
+
+typedef struct {
+    uint32_t size;
+    int32_t  w, h;
+    uint16_t planes;
+    uint16_t bpp;
+    uint32_t comp;
+    uint32_t imgSize;
+    int32_t  xppm, yppm;
+    uint32_t clrUsed;
+    uint32_t clrImp;
+} BMPInfoHeader;
+#pragma pack(pop)
+
+/* ================= Call state =================
+   Every mmsp_decode() runs inside one Call (same scheme as mmsp_enc.c): die()
+   unwinds to it with longjmp, and the blocks and input streams it leaves behind
+   are released there. */
+typedef union MemHdr {
+    struct { union MemHdr *prev, *next; } l;   // self-linked when not owned by a call
+    max_align_t align;
+} MemHdr;
+
+#define MAX_STREAMS (MMSP_MAX_PARTS+2)
+
+typedef struct mmsp_decoder mmsp_decoder;
+typedef struct {
+    jmp_buf fail;
+    int status;
+    char msg[200];
+    MemHdr live;                    // blocks allocated during the call
+    mmsp_decoder* dec;
+    const mmsp_buf* in;             // caller's inputs, in command-line order
+    int nin;
+    FILE* open[MAX_STREAMS];        // memory streams still open
+    FILE* out;                      // output BMP (open_memstream)
+    char* out_data;
+    size_t out_len;
+    FILE* rep;                      // report text (--bench, warnings)
+    char* rep_data;
+    size_t rep_len;
+} Call;
+
+static _Thread_local Call* g_call;
+
+static _Noreturn void fail(int status, const char* msg){
+    if(!g_call) abort(); // every entry point installs a Call first
+    g_call->status = status;
+    snprintf(g_call->msg, sizeof(g_call->msg), "%s", msg);
+    longjmp(g_call->fail, 1);
+}
+static _Noreturn void die(const char* msg){
+    fail(strcmp(msg,"OOM")==0 ? MMSP_ERR_NOMEM : MMSP_ERR_FORMAT, msg);
+}
+
+// malloc/calloc/free below this point go through the call's block list
+static void mem_link(MemHdr* h){
+    if(g_call){
+        h->l.prev = &g_call->live;
+        h->l.next = g_call->live.l.next;
+        h->l.next->l.prev = h;
+        g_call->live.l.next = h;
+    }else{
+        h->l.prev = h->l.next = h;
+    }
+}
+static void mem_unlink(MemHdr* h){
+    h->l.prev->l.next = h->l.next;
+    h->l.next->l.prev = h->l.prev;
+    h->l.prev = h->l.next = h;
+}
+static void* mem_malloc(size_t n){
+    if(n > SIZE_MAX - sizeof(MemHdr)) return NULL;
+    MemHdr* h = (MemHdr*)(malloc)(sizeof(MemHdr) + n);
+    if(!h) return NULL;
+    mem_link(h);
+    return h + 1;
+}
+static void* mem_calloc(size_t n, size_t size){
+    if(size && n > SIZE_MAX/size) return NULL;
+    void* p = mem_malloc(n*size);
+    if(p) memset(p, 0, n*size);
+    return p;
+}
+static void mem_free(void* p){
+    if(!p) return;
+    MemHdr* h = (MemHdr*)p - 1;
+    mem_unlink(h);
+    (free)(h);
+}
+#define malloc(n)    mem_malloc(n)
+#define calloc(n,s)  mem_calloc(n,s)
+#define free(p)      mem_free(p)
+
+// n*size bytes, NULL when the product does not fit size_t (callers die "OOM")
+static void* malloc_n(size_t n, size_t size){ if(size && n > SIZE_MAX/size) return NULL; return malloc(n*size); }
+
+/* ---- input streams ----
+   Inputs are parsed through read-only memory streams, so every format that used
+   to be read from a file (or stdin) keeps its parser, and --index payloads stay
+   seekable. The call closes whatever a failed decode leaves open. */
+static FILE* stream_open(const void* data, size_t len, const char* what){
+    Call* cl = g_call;
+    if(!len){
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s is empty", what);
+        die(msg);
+    }
+    int k=0;
+    while(k<MAX_STREAMS && cl->open[k]) k++;
+    if(k==MAX_STREAMS) die("too many open streams");
+    cl->open[k] = fmemopen((void*)data, len, "rb");
+    if(!cl->open[k]) die("OOM");
+    return cl->open[k];
+}
+// input k of the call (command-line order)
+static FILE* in_open(int k, const char* what){
+    return stream_open(g_call->in[k].data, g_call->in[k].len, what);
+}
+static void in_close(FILE* f){
+    Call* cl = g_call;
+    for(int k=0;k<MAX_STREAMS;k++) if(cl->open[k]==f) cl->open[k] = NULL;
+    fclose(f);
+}
+// bytes between the read position and the end of an input stream
+static uint64_t in_left(FILE* f){
+    off_t pos = ftello(f);
+    if(pos<0 || fseeko(f,0,SEEK_END)!=0) return 0;
+    off_t end = ftello(f);
+    if(fseeko(f,pos,SEEK_SET)!=0 || end<pos) return 0;
+    return (uint64_t)(end-pos);
+}
+// a byte count: u32, or u64 in the wide container forms (M2P1, M3B2/3, M4A1/M4L1, M5R1)
+static int read_size(FILE* f, int wide, uint64_t* v){
+    if(wide) return fread(v,8,1,f)==1;
+    uint32_t v32;
+    if(fread(&v32,4,1,f)!=1) return 0;
+    *v = v32;
+    return 1;
+}
+// W x H within MMSP_MAX_DIM, and the block grid that goes with it
+static int dims_ok(int W, int H){
+    return W>0 && H>0 && W<=MMSP_MAX_DIM && H<=MMSP_MAX_DIM;
+}
+static int block_dims_ok(int W, int H, int bw, int bh){
+    return dims_ok(W,H) && bw==(W+7)/8 && bh==(H+7)/8;
+}
+// the output BMP
+static FILE* bmp_out(void){
+    Call* cl = g_call;
+    if(!cl->out){
+        cl->out = open_memstream(&cl->out_data, &cl->out_len);
+        if(!cl->out) die("OOM");
+    }
+    return cl->out;
+}
+// text for the caller's report (the CLI prints it on stderr)
+static void report(const char* fmt, ...){
+    Call* cl = g_call;
+    if(!cl->rep){
+        cl->rep = open_memstream(&cl->rep_data, &cl->rep_len);
+        if(!cl->rep) die("OOM");
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(cl->rep, fmt, ap);
+    va_end(ap);
+}
+
+/* ================= Utils ================= */
+static int row24(int w){ return ((w*3+3)/4)*4; }
+static int clampi(int x,int lo,int hi){ return x<lo?lo:(x>hi?hi:x); }
+
+/* ================= Options ================= */
+enum { PREC_DOUBLE=MMSP_PREC_DOUBLE, PREC_FLOAT=MMSP_PREC_FLOAT, PREC_INT=MMSP_PREC_INT };
+
+// the parameters of the running call
+typedef mmsp_dec_params DecOptions;
+static _Thread_local DecOptions g_opt;
+
+void mmsp_dec_params_init(mmsp_dec_params* p){
+    memset(p, 0, sizeof(*p));
+    p->scale = 1;
+    p->color_fixed = -1;
+    p->precision = PREC_DOUBLE;
+}
+
+static void set_options(const mmsp_dec_params* p){
+    g_opt = *p;
+    if(g_opt.method<0 || g_opt.method>5) fail(MMSP_ERR_ARG, "method must be 0..5");
+    if(g_opt.scans<0) fail(MMSP_ERR_ARG, "--scans N needs N >= 1");
+    if(g_opt.scale!=1 && g_opt.scale!=2 && g_opt.scale!=4 && g_opt.scale!=8) fail(MMSP_ERR_ARG, "--scale must be 1, 2, 4 or 8");
+    if(g_opt.crop && (g_opt.crop_x<0 || g_opt.crop_y<0 || g_opt.crop_w<=0 || g_opt.crop_h<=0)) fail(MMSP_ERR_ARG, "--crop: bad rectangle");
+    if(g_opt.precision<PREC_DOUBLE || g_opt.precision>PREC_INT) fail(MMSP_ERR_ARG, "bad precision");
+    // --precision int runs the whole reconstruction in integers unless --color float
+    if(g_opt.color_fixed<0) g_opt.color_fixed = (g_opt.precision==PREC_INT);
+}
+
+/* ================= Benchmark timing ================= */
+static double now_sec(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+static void bench_report(const char* what, double sec, size_t in_bytes, long long pixels){
+    if(!g_opt.bench) return;
+    if(sec<=0) sec=1e-9;
+    report("bench: %-22s %9.3f ms  %8.2f MB/s in  %8.2f Mpix/s\n",
+           what, sec*1e3, (double)in_bytes/sec/1e6, (double)pixels/sec/1e6);
+}
+
+/* ================= Buffered text input ================= */
+// Method 0 R/G/B, Method 2 ascii RLE and Method 3 ascii bits are parsed straight
+// from 64 KB fread blocks instead of one fscanf/fgets/fgetc per value.
+#define TXT_BUF_SIZE (1<<16)
+
+typedef struct {
+    FILE* f;
+    size_t pos, len;
+    unsigned char buf[TXT_BUF_SIZE];
+} TxtIn;
+
+// Takes ownership of f; reading continues from its current position.
+static TxtIn* txt_in_wrap(FILE* f){
+    TxtIn* t = (TxtIn*)malloc(sizeof(TxtIn));
+    if(!t) die("OOM");
+    t->f = f;
+    t->pos = t->len = 0;
+    return t;
+}
+static void txt_in_close(TxtIn* t){
+    in_close(t->f);
+    free(t);
+}
+static int txt_refill(TxtIn* t){
+    t->len = fread(t->buf,1,TXT_BUF_SIZE,t->f);
+    t->pos = 0;
+    return t->len > 0;
+}
+static inline int txt_peek(TxtIn* t){
+    if(t->pos == t->len && !txt_refill(t)) return EOF;
+    return t->buf[t->pos];
+}
+static inline int txt_getc(TxtIn* t){
+    if(t->pos == t->len && !txt_refill(t)) return EOF;
+    return t->buf[t->pos++];
+}
+static inline int is_space_ch(int c){
+    return c==' '||c=='\t'||c=='\r'||c=='\n'||c=='\v'||c=='\f';
+}
+// Skips spaces and tabs but stops at end of line.
+static inline void txt_skip_blanks(TxtIn* t){
+    int c;
+    while((c=txt_peek(t))==' '||c=='\t'||c=='\r') t->pos++;
+}
+// Same contract as fscanf("%d"): leading whitespace (newlines included) is skipped.
+static int txt_read_int(TxtIn* t, int* out){
+    int c;
+    while(is_space_ch(c=txt_peek(t))) t->pos++;
+    int neg=0;
+    if(c=='-'||c=='+'){ neg=(c=='-'); t->pos++; c=txt_peek(t); }
+    if(c<'0'||c>'9') return 0;
+    long v=0;
+    while((c=txt_peek(t))>='0' && c<='9'){
+        if(v < 100000000L) v = v*10 + (c-'0');
+        t->pos++;
+    }
+    *out = (int)(neg?-v:v);
+    return 1;
+}
+static void txt_skip_line(TxtIn* t){
+    int c;
+    while((c=txt_getc(t))!=EOF && c!='\n'){}
+}
+
+/* ================= DCT/IDCT tables ================= */
+static double COS8[8][8];
+static double A8[8];
+
+// reduced N-point IDCT tables (N=2,4) for --scale 4/2: cos((2x+1)u*pi/2N)
+static double COS4[4][4];
+static double COS2[2][2];
+
+// --precision float|int: basis with the scale folded in, C[u][x] = 0.5*alpha(u)*cos(u,x)
+#define DCT_FIX 13          // int basis in Q13
+static float   COS8F[8][8];
+static int16_t COS8I[8][8];
+
+static void init_dct(void){
+    for(int u=0;u<8;u++){
+        A8[u] = (u==0)? 1.0/sqrt(2.0) : 1.0;
+        for(int x=0;x<8;x++){
+            COS8[u][x] = cos(((2.0*x+1.0)*u*M_PI)/16.0);
+        }
+    }
+    for(int u=0;u<4;u++) for(int x=0;x<4;x++) COS4[u][x] = cos(((2.0*x+1.0)*u*M_PI)/8.0);
+    for(int u=0;u<2;u++) for(int x=0;x<2;x++) COS2[u][x] = cos(((2.0*x+1.0)*u*M_PI)/4.0);
+    for(int u=0;u<8;u++){
+        for(int x=0;x<8;x++){
+            double c = 0.5*A8[u]*COS8[u][x];
+            COS8F[u][x] = (float)c;
+            COS8I[u][x] = (int16_t)lround(c*(1<<DCT_FIX));
+        }
+    }
+}
+
+static void idct8x8(const double in[8][8], double out[8][8]){
+    // out[x][y] = 0.25 * sum_u sum_v alpha(u)alpha(v) in[u][v] cos(u,x) cos(v,y)
+    double tmp[8][8] = {{0}};
+    for(int x=0;x<8;x++){
+        for(int v=0;v<8;v++){
+            double s=0.0;
+            for(int u=0;u<8;u++){
+                s += A8[u]*in[u][v]*COS8[u][x];
+            }
+            tmp[x][v]=s;
+        }
+    }
+    for(int x=0;x<8;x++){
+        for(int y=0;y<8;y++){
+            double s=0.0;
+            for(int v=0;v<8;v++){
+                s += A8[v]*tmp[x][v]*COS8[v][y];
+            }
+            out[x][y] = 0.25*s;
+        }
+    }
+}
+
+// Both reduced-precision IDCTs run row-at-a-time: each step broadcasts one value
+// over a contiguous 8-wide row, which the compiler vectorizes (the int version
+// as 16x16->32 multiplies).
+static void idct8x8_f(const float in[8][8], float out[8][8]){
+    float tmp[8][8];
+    // tmp[x][v] = sum_u C[u][x] * in[u][v]
+    for(int x=0;x<8;x++){
+        float acc[8]={0};
+        for(int u=0;u<8;u++){
+            float c = COS8F[u][x];
+            for(int v=0;v<8;v++) acc[v] += c*in[u][v];
+        }
+        for(int v=0;v<8;v++) tmp[x][v]=acc[v];
+    }
+    // out[x][y] = sum_v tmp[x][v] * C[v][y]
+    for(int x=0;x<8;x++){
+        float acc[8]={0};
+        for(int v=0;v<8;v++){
+            float t = tmp[x][v];
+            for(int y=0;y<8;y++) acc[y] += t*COS8F[v][y];
+        }
+        for(int y=0;y<8;y++) out[x][y]=acc[y];
+    }
+}
+
+// Integer IDCT: dequantized coefficients (clamped by the caller to |in| <= 2047,
+// about twice the largest an 8-bit block can produce) -> rounded level-shifted
+// samples. Pass 1 keeps 2 fraction bits; with that clamp it stays inside int16
+// (|tmp| <= 2047*3.86*4 < 32768) and every partial sum below 2^30.
+#define IDCT_IN_MAX 2047
+static void idct8x8_i(const int16_t in[8][8], int32_t out[8][8]){
+    int16_t tmp[8][8];
+    for(int x=0;x<8;x++){
+        int32_t acc[8];
+        for(int v=0;v<8;v++) acc[v] = 1<<(DCT_FIX-2-1);
+        for(int u=0;u<8;u++){
+            int16_t c = COS8I[u][x];
+            for(int v=0;v<8;v++) acc[v] += c*in[u][v];
+        }
+        for(int v=0;v<8;v++) tmp[x][v] = (int16_t)(acc[v] >> (DCT_FIX-2));
+    }
+    for(int x=0;x<8;x++){
+        int32_t acc[8];
+        for(int y=0;y<8;y++) acc[y] = 1<<(DCT_FIX+2-1);
+        for(int v=0;v<8;v++){
+            int16_t t = tmp[x][v];
+            for(int y=0;y<8;y++) acc[y] += t*COS8I[v][y];
+        }
+        for(int y=0;y<8;y++) out[x][y] = acc[y] >> (DCT_FIX+2);
+    }
+}
+
+// 8x8 IDCT of double coefficients at the selected --precision (Method 1)
+static void idct8x8_prec(const double in[8][8], double out[8][8]){
+    if(g_opt.precision==PREC_FLOAT){
+        float fi[8][8], fo[8][8];
+        for(int u=0;u<8;u++) for(int v=0;v<8;v++) fi[u][v]=(float)in[u][v];
+        idct8x8_f(fi, fo);
+        for(int x=0;x<8;x++) for(int y=0;y<8;y++) out[x][y]=fo[x][y];
+    }else if(g_opt.precision==PREC_INT){
+        int16_t ii[8][8];
+        int32_t io[8][8];
+        for(int u=0;u<8;u++) for(int v=0;v<8;v++) ii[u][v]=(int16_t)clampi((int)lround(in[u][v]),-IDCT_IN_MAX,IDCT_IN_MAX);
+        idct8x8_i(ii, io);
+        for(int x=0;x<8;x++) for(int y=0;y<8;y++) out[x][y]=io[x][y];
+    }else{
+        idct8x8(in, out);
+    }
+}
+
+// Scaled IDCT: only the N x N lowest coefficients, producing an N x N block.
+// The orthonormal 8-point basis restricted to N points gives the same 0.25 factor:
+//   out[x][y] = 0.25 * sum_{u,v<N} alpha(u)alpha(v) in[u][v] cosN(u,x) cosN(v,y)
+static void idct_scaled(const double in[8][8], int N, double out[8][8]){
+    const double* cs = (N==4)? &COS4[0][0] : &COS2[0][0];
+    double tmp[4][4];
+    for(int x=0;x<N;x++){
+        for(int v=0;v<N;v++){
+            double s=0.0;
+            for(int u=0;u<N;u++) s += A8[u]*in[u][v]*cs[u*N+x];
+            tmp[x][v]=s;
+        }
+    }
+    for(int x=0;x<N;x++){
+        for(int y=0;y<N;y++){
+            double s=0.0;
+            for(int v=0;v<N;v++) s += A8[v]*tmp[x][v]*cs[v*N+y];
+            out[x][y] = 0.25*s;
+        }
+    }
+}
+
+/* ---- Reversible integer IDCT (M2L0 / M4L0 lossless payloads) ----
+   Exact inverse of the encoder's lifting DCT: the same rotations undone in
+   reverse order, each lifting step subtracting the product it added. */
+#define LIFT_BITS 12
+typedef struct { int32_t p, u; } LiftRot;
+static const LiftRot LIFT_R4   = { -1697,  2896 };  //  pi/4
+static const LiftRot LIFT_R8   = {   815, -1567 };  // -pi/8
+static const LiftRot LIFT_R16  = {   403,  -799 };  // -pi/16
+static const LiftRot LIFT_R316 = {  1243, -2276 };  // -3pi/16
+
+static inline int32_t lift_mul(int32_t c, int32_t y){ return (c*y + (1<<(LIFT_BITS-1))) >> LIFT_BITS; }
+static inline void lift_unrot(const LiftRot* r, int32_t* a, int32_t* b){
+    *a -= lift_mul(r->p,*b);
+    *b -= lift_mul(r->u,*a);
+    *a -= lift_mul(r->p,*b);
+}
+
+static void lift_idct8(int32_t* v, int stride){
+    int32_t x[8];
+    x[5]=v[0]; x[1]=v[stride]; x[7]=v[2*stride]; x[0]=v[3*stride];
+    x[4]=v[4*stride]; x[3]=v[5*stride]; x[6]=-v[6*stride]; x[2]=v[7*stride];
+    lift_unrot(&LIFT_R4,&x[0],&x[3]);
+    lift_unrot(&LIFT_R4,&x[2],&x[3]);
+    lift_unrot(&LIFT_R4,&x[0],&x[1]);
+    lift_unrot(&LIFT_R316,&x[1],&x[2]);
+    lift_unrot(&LIFT_R16,&x[0],&x[3]);
+    lift_unrot(&LIFT_R8,&x[7],&x[6]);
+    lift_unrot(&LIFT_R4,&x[4],&x[5]);
+    lift_unrot(&LIFT_R4,&x[6],&x[5]);
+    lift_unrot(&LIFT_R4,&x[7],&x[4]);
+    for(int n=3;n>=0;n--) lift_unrot(&LIFT_R4,&x[n],&x[7-n]);
+    for(int i=0;i<8;i++) v[i*stride]=x[i];
+}
+
+// columns then rows (the encoder went rows then columns)
+static void lift_idct8x8(int32_t b[8][8]){
+    for(int j=0;j<8;j++) lift_idct8(&b[0][j], 8);
+    for(int i=0;i<8;i++) lift_idct8(b[i], 1);
+}
+
+/* ================= Color ================= */
+// inverse YCoCg-R (lossless payload)
+static inline void ycocg_r_to_rgb(int32_t Y, int32_t Co, int32_t Cg, int32_t* r, int32_t* g, int32_t* b){
+    int32_t t = Y - (Cg>>1);
+    *g = Cg + t;
+    *b = t - (Co>>1);
+    *r = *b + Co;
+}
+static void ycbcr_to_rgb(double Y, double Cb, double Cr, uint8_t* R, uint8_t* G, uint8_t* B){
+    double r = Y + 1.402*(Cr-128.0);
+    double g = Y - 0.344136*(Cb-128.0) - 0.714136*(Cr-128.0);
+    double b = Y + 1.772*(Cb-128.0);
+    int ri = (int)llround(r);
+    int gi = (int)llround(g);
+    int bi = (int)llround(b);
+    *R = (uint8_t)clampi(ri,0,255);
+    *G = (uint8_t)clampi(gi,0,255);
+    *B = (uint8_t)clampi(bi,0,255);
+}
+
+// --color fixed: 16.16 fixed-point inverse with saturating clamps. Inputs are
+// YCbCr already range-limited to 0..255, one row at a time so the loop vectorizes.
+#define CSC_FIX 16
+static inline int32_t sat_u8(int32_t v){ v = v<0 ? 0 : v; return v>255 ? 255 : v; }
+// double sample (level shift included) -> rounded, range-limited 0..255;
+// truncation only differs from rounding below 0, which clamps to 0 anyway
+static inline int32_t level_u8(double v){ return sat_u8((int32_t)(v + 128.5)); }
+
+static void ycbcr_to_rgb_fixed_row(const int32_t* Y, const int32_t* Cb, const int32_t* Cr, int n,
+                                   uint8_t* R, uint8_t* G, uint8_t* B){
+    for(int i=0;i<n;i++){
+        int32_t y=Y[i], cb=Cb[i]-128, cr=Cr[i]-128;
+        R[i] = (uint8_t)sat_u8(y + (( 91881*cr            + (1<<(CSC_FIX-1))) >> CSC_FIX));
+        G[i] = (uint8_t)sat_u8(y + ((-22554*cb - 46802*cr + (1<<(CSC_FIX-1))) >> CSC_FIX));
+        B[i] = (uint8_t)sat_u8(y + ((116130*cb            + (1<<(CSC_FIX-1))) >> CSC_FIX));
+    }
+}
+
+/* ================= Quant tables (must match encoder) ================= */
+static const int QY[8][8]={
+ {16,11,10,16,24,40,51,61},{12,12,14,19,26,58,60,55},
+ {14,13,16,24,40,57,69,56},{14,17,22,29,51,87,80,62},
+ {18,22,37,56,68,109,103,77},{24,35,55,64,81,104,113,92},
+ {49,64,78,87,103,121,120,101},{72,92,95,98,112,100,103,99}
+};
+static const int QC[8][8]={
+ {17,18,24,47,99,99,99,99},{18,21,26,66,99,99,99,99},
+ {24,26,56,99,99,99,99,99},{47,66,99,99,99,99,99,99},
+ {99,99,99,99,99,99,99,99},{99,99,99,99,99,99,99,99},
+ {99,99,99,99,99,99,99,99},{99,99,99,99,99,99,99,99}
+};
+
+/* ================= ZigZag (must match encoder) ================= */
+static const int ZZU[64] = {
+ 0,0,1,2,1,0,0,1,2,3,4,3,2,1,0,0,
+ 1,2,3,4,5,6,5,4,3,2,1,0,1,2,3,4,
+ 5,6,7,7,6,5,4,3,2,3,4,5,6,7,7,6,
+ 5,4,5,6,7,7,6,7,7,7,7,7,7,7,7,7
+};
+static const int ZZV[64] = {
+ 0,1,0,0,1,2,3,2,1,0,0,1,2,3,4,5,
+ 4,3,2,1,0,0,1,2,3,4,5,6,7,6,5,4,
+ 3,2,1,0,1,2,3,4,5,6,7,7,6,5,4,3,
+ 4,5,6,7,7,6,5,6,7,7,6,5,4,3,2,1
+};
+
+typedef struct { int16_t skip; int16_t val; } Pair;
+
+/* ================= BMP writer using HDR54 ================= */
+/* R,G,B planes -> BGR row: scalar loop plus an SSSE3 pshufb kernel (16 pixels per
+   step) on x86 GCC/Clang, picked at run time. -DNO_SIMD disables. */
+#if !defined(NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BMP_SIMD_X86 1
+#include <tmmintrin.h>
+#endif
+
+static void merge_bgr24_scalar(uint8_t* row, const uint8_t* R, const uint8_t* G, const uint8_t* B, int x0, int W){
+    for(int x=x0;x<W;x++){
+        row[x*3+0] = B[x];
+        row[x*3+1] = G[x];
+        row[x*3+2] = R[x];
+    }
+}
+
+#ifdef BMP_SIMD_X86
+#define Z 0x80
+// MERGE3[k][v]: places channel k (0=B,1=G,2=R) of 16 pixels into the v-th 16-byte output chunk
+static const uint8_t MERGE3[3][3][16] = {
+    {{0,Z,Z,1,Z,Z,2,Z,Z,3,Z,Z,4,Z,Z,5}, {Z,Z,6,Z,Z,7,Z,Z,8,Z,Z,9,Z,Z,10,Z}, {Z,11,Z,Z,12,Z,Z,13,Z,Z,14,Z,Z,15,Z,Z}},
+    {{Z,0,Z,Z,1,Z,Z,2,Z,Z,3,Z,Z,4,Z,Z}, {5,Z,Z,6,Z,Z,7,Z,Z,8,Z,Z,9,Z,Z,10}, {Z,Z,11,Z,Z,12,Z,Z,13,Z,Z,14,Z,Z,15,Z}},
+    {{Z,Z,0,Z,Z,1,Z,Z,2,Z,Z,3,Z,Z,4,Z}, {Z,5,Z,Z,6,Z,Z,7,Z,Z,8,Z,Z,9,Z,Z}, {10,Z,Z,11,Z,Z,12,Z,Z,13,Z,Z,14,Z,Z,15}},
+};
+#undef Z
+
+__attribute__((target("ssse3")))
+static int merge_bgr24_ssse3(uint8_t* row, const uint8_t* R, const uint8_t* G, const uint8_t* B, int W){
+    __m128i m[3][3];
+    for(int k=0;k<3;k++) for(int v=0;v<3;v++) m[k][v] = _mm_loadu_si128((const __m128i*)MERGE3[k][v]);
+    int x=0;
+    for(; x+16<=W; x+=16){
+        __m128i b = _mm_loadu_si128((const __m128i*)(B + x));
+        __m128i g = _mm_loadu_si128((const __m128i*)(G + x));
+        __m128i r = _mm_loadu_si128((const __m128i*)(R + x));
+        for(int v=0;v<3;v++){
+            __m128i o = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b,m[0][v]), _mm_shuffle_epi8(g,m[1][v])),
+                                     _mm_shuffle_epi8(r,m[2][v]));
+            _mm_storeu_si128((__m128i*)(row + x*3 + 16*v), o);
+        }
+    }
+    return x;
+}
+#endif
+
+static void merge_row(uint8_t* row, const uint8_t* R, const uint8_t* G, const uint8_t* B, int W){
+    int x0 = 0;
+#ifdef BMP_SIMD_X86
+    static int has_ssse3 = -1;
+    if(has_ssse3 < 0) has_ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    if(has_ssse3) x0 = merge_bgr24_ssse3(row,R,G,B,W);
+#endif
+    merge_bgr24_scalar(row,R,G,B,x0,W);
+}
+
+// Planes are W x H with the given row stride (>= W), so a padded decode buffer
+// is cropped here rather than per pixel.
+static void write_bmp_from_topdown_rgb(int W, int H, int stride,
+                                      const uint8_t* R, const uint8_t* G, const uint8_t* B,
+                                      const uint8_t hdr54[54]){
+    FILE* f = bmp_out();
+
+    int rs = row24(W);
+
+    // write original 54-byte header; if its size fields don't describe this image
+    // (scaled/cropped output or the template header) fix them up, rows stay bottom-up
+    BMPFileHeader fh; BMPInfoHeader ih;
+    memcpy(&fh, hdr54, sizeof(fh));
+    memcpy(&ih, hdr54+sizeof(fh), sizeof(ih));
+    int hdrH = (ih.h<0)? -ih.h : ih.h;
+    if(ih.w!=W || hdrH!=H || ih.bpp!=24 || ih.comp!=0){
+        // (a 32-bit original header is rewritten as plain 24-bit BI_RGB as well)
+        uint8_t fixed[54];
+        ih.size = 40; ih.bpp = 24; ih.comp = 0;
+        ih.w = W; ih.h = H;
+        // 0 ("not given") when the pixel array does not fit the 32-bit fields
+        uint64_t img = (uint64_t)rs*(uint64_t)H;
+        ih.imgSize = (img+54 <= UINT32_MAX) ? (uint32_t)img : 0;
+        fh.bfSize = ih.imgSize ? 54 + ih.imgSize : 0;
+        fh.offBits = 54;
+        memcpy(fixed, &fh, sizeof(fh));
+        memcpy(fixed+sizeof(fh), &ih, sizeof(ih));
+        fwrite(fixed,1,54,f);
+    }else{
+        fwrite(hdr54,1,54,f);
+    }
+
+    uint8_t* row = (uint8_t*)calloc((size_t)rs,1);
+    if(!row) die("OOM");
+
+    // BMP pixel array is bottom-up; padding bytes past W*3 stay zero
+    for(int y=H-1;y>=0;y--){
+        size_t o = (size_t)y*stride;
+        merge_row(row, R+o, G+o, B+o, W);
+        fwrite(row,1,(size_t)rs,f);
+    }
+
+    free(row);
+}
+
+/* ================= dim.txt reader (W H + HDR54 line) ================= */
+static void read_dim_and_hdr54(FILE* fd, int* W, int* H, uint8_t hdr54[54]){
+
+    if(fscanf(fd,"%d %d", W, H)!=2) die("dim.txt missing W H");
+    if(!dims_ok(*W,*H)) die("dim.txt: W H out of range");
+
+    char tag[16]={0};
+    if(fscanf(fd,"%15s", tag)!=1) die("dim.txt missing HDR54 tag");
+    if(strcmp(tag,"HDR54")!=0) die("dim.txt HDR54 missing");
+
+    for(int i=0;i<54;i++){
+        unsigned int byte;
+        if(fscanf(fd,"%2x",&byte)!=1) die("dim.txt HDR54 hex parse failed");
+        hdr54[i]=(uint8_t)byte;
+    }
+    in_close(fd);
+}
+
+/* =========================================================
+   Method 0 decoder
+   inputs: R.txt G.txt B.txt dim.txt
+========================================================= */
+static void decode_method0(void){
+    if(g_call->nin!=4) fail(MMSP_ERR_ARG, "Method-0: inputs are R.txt G.txt B.txt dim.txt");
+
+    int W,H;
+    uint8_t hdr54[54];
+    read_dim_and_hdr54(in_open(3,"dim.txt"),&W,&H,hdr54);
+
+    TxtIn* fr=txt_in_wrap(in_open(0,"R.txt"));
+    TxtIn* fg=txt_in_wrap(in_open(1,"G.txt"));
+    TxtIn* fb=txt_in_wrap(in_open(2,"B.txt"));
+
+    uint8_t* R=(uint8_t*)malloc_n((size_t)W,(size_t)H);
+    uint8_t* G=(uint8_t*)malloc_n((size_t)W,(size_t)H);
+    uint8_t* B=(uint8_t*)malloc_n((size_t)W,(size_t)H);
+    if(!R||!G||!B) die("OOM");
+
+    for(int y=0;y<H;y++){
+        for(int x=0;x<W;x++){
+            size_t o=(size_t)y*W+x;
+            int v;
+            if(!txt_read_int(fr,&v)) die("R.txt parse failed");
+            R[o]=(uint8_t)v;
+            if(!txt_read_int(fg,&v)) die("G.txt parse failed");
+            G[o]=(uint8_t)v;
+            if(!txt_read_int(fb,&v)) die("B.txt parse failed");
+            B[o]=(uint8_t)v;
+        }
+    }
+
+    txt_in_close(fr); txt_in_close(fg); txt_in_close(fb);
+
+    write_bmp_from_topdown_rgb(W,H,W,R,G,B,hdr54);
+    free(R); free(G); free(B);
+}
+
+/* =========================================================
+   Method 1 decoder
+   1(a): original.bmp Qt_Y Qt_Cb Qt_Cr dim qF_Y qF_Cb qF_Cr
+   1(b): [original.bmp] Qt_Y Qt_Cb Qt_Cr dim qF_Y qF_Cb qF_Cr eF_Y eF_Cb eF_Cr
+   1(c): [original.bmp] Qt_Y Qt_Cb Qt_Cr dim coef.raw  (interleaved "M1I0")
+   (flexible: an input starting with "BM" is original.bmp)
+   The raw files are read one block row at a time.
+========================================================= */
+#define M1_BLOCK_BYTES (3*64*(sizeof(int16_t)+sizeof(float)))
+
+static float* ef_compact_read(FILE* f, size_t n); // --ef compact planes, see below
+static int is_bmp_input(const mmsp_buf* b){
+    return b->len>=54 && b->data[0]=='B' && b->data[1]=='M';
+}
+
+static void decode_method1(void){
+    // detect form: 5 (c), 6 (c with original), 8 (a), 10 (b), 11 (b with original)
+    const int nin = g_call->nin;
+    if(!mmsp_dec_nin_ok(1, nin)){
+        fail(MMSP_ERR_ARG, "Method-1: inputs are [original.bmp] Qt_Y Qt_Cb Qt_Cr dim then qF x3 [eF x3] or coef");
+    }
+
+    int idx = 0;
+    uint8_t hdr54[54]={0};
+    int has_orig = 0;
+
+    // if the first input is a bmp, take hdr54 from it
+    if(is_bmp_input(&g_call->in[0])){
+        has_orig = 1;
+        memcpy(hdr54, g_call->in[0].data, 54);
+        idx++;
+    }
+    idx += 3; // Qt_Y Qt_Cb Qt_Cr: the tables are fixed (QY/QC)
+    FILE* fd = in_open(idx++,"dim.txt");
+
+    int W,H;
+    if(!has_orig){
+        read_dim_and_hdr54(fd,&W,&H,hdr54);
+    }else{
+        // still need W,H from dim
+        if(fscanf(fd,"%d %d",&W,&H)!=2) die("dim W H parse failed");
+        if(!dims_ok(W,H)) die("dim.txt: W H out of range");
+        in_close(fd);
+    }
+
+    int bw=(W+7)/8, bh=(H+7)/8;
+    size_t nrow = (size_t)bw*64; // coefficients per channel and block row
+
+    FILE* fq[3]={NULL,NULL,NULL};
+    FILE* fe[3]={NULL,NULL,NULL};
+    FILE* fi=NULL;
+    int has_e = 0;
+    if(nin - idx == 1){
+        // interleaved: "M1I0" + W,H,bw,bh (int32), then per block Y,Cb,Cr x (64 int16 qF, 64 float eF)
+        fi = in_open(idx++,"coef.raw");
+        char magic[4]; int32_t hdr[4];
+        if(fread(magic,1,4,fi)!=4 || memcmp(magic,"M1I0",4)!=0) die("method1: bad interleaved magic");
+        if(fread(hdr,sizeof(hdr),1,fi)!=1) die("method1: interleaved header short read");
+        if(hdr[0]!=W || hdr[1]!=H || hdr[2]!=bw || hdr[3]!=bh) die("method1: interleaved header does not match dim");
+        has_e = 1;
+    }else{
+        for(int c=0;c<3;c++) fq[c] = in_open(idx++,"qF raw");
+        if(idx < nin){
+            // must be 3 files
+            if((nin - idx) != 3) fail(MMSP_ERR_ARG, "method1: eF args count mismatch");
+            has_e = 1;
+            for(int c=0;c<3;c++) fe[c] = in_open(idx++,"eF raw");
+        }
+    }
+
+    // eF written with --ef compact starts with "EFC0" and is decoded whole up front
+    float* efc[3]={NULL,NULL,NULL};
+    for(int c=0;c<3;c++){
+        char magic[4];
+        if(!fe[c]) continue;
+        if(fread(magic,1,4,fe[c])==4 && memcmp(magic,"EFC0",4)==0){
+            efc[c] = ef_compact_read(fe[c], nrow*(size_t)bh);
+            in_close(fe[c]); fe[c] = NULL;
+        }else{
+            rewind(fe[c]);
+        }
+    }
+
+    // whole blocks are written into planes padded to a multiple of 8; the
+    // writer crops to W x H
+    int PW=bw*8;
+    uint8_t* R=(uint8_t*)malloc_n((size_t)PW,(size_t)bh*8);
+    uint8_t* G=(uint8_t*)malloc_n((size_t)PW,(size_t)bh*8);
+    uint8_t* B=(uint8_t*)malloc_n((size_t)PW,(size_t)bh*8);
+    int16_t* qrow=(int16_t*)malloc(3*nrow*sizeof(int16_t)); // [c][bx*64 + u*8+v]
+    float*   erow=(float*)calloc(3*nrow, sizeof(float));
+    uint8_t* irow=fi ? (uint8_t*)malloc((size_t)bw*M1_BLOCK_BYTES) : NULL;
+    if(!R||!G||!B||!qrow||!erow||(fi && !irow)) die("OOM");
+
+    static const char* qerr[3]={"qF_Y short read","qF_Cb short read","qF_Cr short read"};
+    static const char* eerr[3]={"eF_Y short read","eF_Cb short read","eF_Cr short read"};
+
+    for(int by=0; by<bh; by++){
+        if(fi){
+            if(fread(irow,1,(size_t)bw*M1_BLOCK_BYTES,fi)!=(size_t)bw*M1_BLOCK_BYTES) die("interleaved coef short read");
+            const uint8_t* p = irow;
+            for(int bx=0; bx<bw; bx++){
+                for(int c=0;c<3;c++){
+                    memcpy(qrow + c*nrow + (size_t)bx*64, p, 64*sizeof(int16_t)); p += 64*sizeof(int16_t);
+                    memcpy(erow + c*nrow + (size_t)bx*64, p, 64*sizeof(float));   p += 64*sizeof(float);
+                }
+            }
+        }else{
+            for(int c=0;c<3;c++){
+                if(fread(qrow + c*nrow, sizeof(int16_t), nrow, fq[c])!=nrow) die(qerr[c]);
+                if(efc[c]) memcpy(erow + c*nrow, efc[c] + (size_t)by*nrow, nrow*sizeof(float));
+                else if(has_e && fread(erow + c*nrow, sizeof(float), nrow, fe[c])!=nrow) die(eerr[c]);
+            }
+        }
+        for(int bx=0; bx<bw; bx++){
+            // F = qF * Q (+ eF); without eF files erow stays zero
+            double F[3][8][8];
+            for(int c=0;c<3;c++){
+                const int16_t* q = qrow + c*nrow + (size_t)bx*64;
+                const float*   e = erow + c*nrow + (size_t)bx*64;
+                for(int u=0;u<8;u++){
+                    for(int v=0;v<8;v++){
+                        double Q = (c==0)? (double)QY[u][v] : (double)QC[u][v];
+                        F[c][u][v] = (double)q[u*8+v] * Q + (double)e[u*8+v];
+                    }
+                }
+            }
+
+            double blkY[8][8], blkCb[8][8], blkCr[8][8];
+            idct8x8_prec(F[0], blkY);
+            idct8x8_prec(F[1], blkCb);
+            idct8x8_prec(F[2], blkCr);
+
+            for(int i=0;i<8;i++){
+                size_t o = (size_t)(by*8+i)*PW + bx*8;
+                if(g_opt.color_fixed){
+                    int32_t Yi[8], Cbi[8], Cri[8];
+                    for(int j=0;j<8;j++){
+                        Yi[j] = level_u8(blkY[i][j]); Cbi[j] = level_u8(blkCb[i][j]); Cri[j] = level_u8(blkCr[i][j]);
+                    }
+                    ycbcr_to_rgb_fixed_row(Yi,Cbi,Cri,8,R+o,G+o,B+o);
+                    continue;
+                }
+                for(int j=0;j<8;j++){
+                    double Yv  = blkY[i][j]  + 128.0;
+                    double Cbv = blkCb[i][j] + 128.0;
+                    double Crv = blkCr[i][j] + 128.0;
+                    ycbcr_to_rgb(Yv, Cbv, Crv, &R[o+j], &G[o+j], &B[o+j]);
+                }
+            }
+        }
+    }
+
+    for(int c=0;c<3;c++){
+        if(fq[c]) in_close(fq[c]);
+        if(fe[c]) in_close(fe[c]);
+        free(efc[c]);
+    }
+    if(fi) in_close(fi);
+    free(qrow); free(erow); free(irow);
+
+    write_bmp_from_topdown_rgb(W,H,PW,R,G,B,hdr54);
+    free(R); free(G); free(B);
+}
+
+/* ================= Output view (Method 2/3/4/5) ================= */
+// The part of the decoded image that is produced, in output pixels: the whole
+// image or the --crop rectangle, at 1/--scale. Blocks outside it are skipped.
+// The planes cover every block touching the window (block-aligned, so whole
+// N x N blocks are stored without bounds checks) and are cropped on write.
+typedef struct {
+    int scale;              // 1,2,4,8 -> each block yields N = 8/scale pixels per side
+    int x0, y0, w, h;       // window in output pixels
+    int px0, py0;           // origin of the padded planes (window rounded down to N)
+    int stride, ph;         // padded plane size
+    uint8_t *R, *G, *B;     // stride*ph top-down planes
+} OutView;
+
+static void out_view_init(OutView* ov, int W, int H){
+    int s = g_opt.scale;
+    int cx=0, cy=0, cx1=W, cy1=H;
+    if(g_opt.crop){
+        cx=g_opt.crop_x; cy=g_opt.crop_y;
+        cx1 = (g_opt.crop_w > W-cx) ? W : cx+g_opt.crop_w;
+        cy1 = (g_opt.crop_h > H-cy) ? H : cy+g_opt.crop_h;
+        if(cx>=W || cy>=H) die("--crop: rectangle is outside the image");
+    }
+    ov->scale = s;
+    ov->x0 = cx/s;  ov->y0 = cy/s;
+    ov->w  = (cx1+s-1)/s - ov->x0;
+    ov->h  = (cy1+s-1)/s - ov->y0;
+    int N = 8/s;
+    ov->px0 = ov->x0/N*N;
+    ov->py0 = ov->y0/N*N;
+    ov->stride = (ov->x0+ov->w+N-1)/N*N - ov->px0;
+    ov->ph     = (ov->y0+ov->h+N-1)/N*N - ov->py0;
+    size_t np = (size_t)ov->stride*ov->ph;
+    ov->R=(uint8_t*)malloc(np);
+    ov->G=(uint8_t*)malloc(np);
+    ov->B=(uint8_t*)malloc(np);
+    if(!ov->R||!ov->G||!ov->B) die("OOM");
+}
+// block rows / columns that touch the view
+static int out_view_row(const OutView* ov, int m){
+    int N = 8/ov->scale;
+    return (m+1)*N > ov->y0 && m*N < ov->y0+ov->h;
+}
+static int out_view_col(const OutView* ov, int n){
+    int N = 8/ov->scale;
+    return (n+1)*N > ov->x0 && n*N < ov->x0+ov->w;
+}
+static int out_view_last_row(const OutView* ov){
+    return (ov->y0+ov->h-1)/(8/ov->scale);
+}
+static void out_view_write(OutView* ov, const uint8_t hdr54[54]){
+    size_t o = (size_t)(ov->y0-ov->py0)*ov->stride + (ov->x0-ov->px0);
+    write_bmp_from_topdown_rgb(ov->w,ov->h,ov->stride,ov->R+o,ov->G+o,ov->B+o,hdr54);
+    free(ov->R); free(ov->G); free(ov->B);
+}
+
+/* ================= Block reconstruction ================= */
+// zz[c] holds absolute (DPCM-undone) zigzag coefficients of block (m,n);
+// de-zigzag, dequant, IDCT, then YCbCr -> RGB into the view.
+// With --scale only the N x N low-frequency corner is used: N=1 is the block
+// mean (DC only, no IDCT), N=2/4 use the reduced IDCT.
+static void put_block_rgb(const int16_t zz[3][64], int m, int n, OutView* ov){
+    int N = 8/ov->scale;
+    // --precision int: integer dequant + IDCT (and DC-only); the reduced IDCTs stay double
+    int ints = (g_opt.precision==PREC_INT && N!=2 && N!=4);
+    double blk[3][8][8]; // spatial (level-shifted)
+    int32_t blki[3][8][8];
+    for(int c=0;c<3;c++){
+        if(ints){
+            if(N==1){
+                int32_t d = (int32_t)zz[c][0] * ((c==0)? QY[0][0] : QC[0][0]);
+                blki[c][0][0] = d>=0 ? (d+4)/8 : -((-d+4)/8);
+                continue;
+            }
+            int16_t Fi[8][8]={{0}}; // ZZU/ZZV do not reach every (u,v)
+            for(int t=0;t<64;t++){
+                int32_t f = (int32_t)zz[c][t] * ((c==0)? QY[ZZU[t]][ZZV[t]] : QC[ZZU[t]][ZZV[t]]);
+                Fi[ZZU[t]][ZZV[t]] = (int16_t)clampi(f,-IDCT_IN_MAX,IDCT_IN_MAX);
+            }
+            idct8x8_i(Fi, blki[c]);
+            continue;
+        }
+        if(N==1){
+            blk[c][0][0] = (double)zz[c][0] * ((c==0)? QY[0][0] : QC[0][0]) / 8.0;
+            continue;
+        }
+        // De-zigzag into F[u][v], then dequant, then IDCT
+        double F[8][8]={{0}};
+        for(int t=0;t<64;t++){
+            int u=ZZU[t], v=ZZV[t];
+            if(u>=N || v>=N) continue;
+            double q = (double)zz[c][t];
+            double Q = (c==0)? (double)QY[u][v] : (double)QC[u][v];
+            F[u][v] = q * Q;
+        }
+        if(N==8 && g_opt.precision==PREC_FLOAT){
+            float Ff[8][8], bf[8][8];
+            for(int u=0;u<8;u++) for(int v=0;v<8;v++) Ff[u][v]=(float)F[u][v];
+            idct8x8_f(Ff, bf);
+            for(int i=0;i<8;i++) for(int j=0;j<8;j++) blk[c][i][j]=bf[i][j];
+        }
+        else if(N==8) idct8x8(F, blk[c]);
+        else idct_scaled(F, N, blk[c]);
+    }
+    if(ints && !g_opt.color_fixed){
+        for(int c=0;c<3;c++) for(int i=0;i<N;i++) for(int j=0;j<N;j++) blk[c][i][j]=(double)blki[c][i][j];
+    }
+
+    // combine channels -> RGB; the block lies wholly inside the padded planes
+    size_t o = (size_t)(m*N-ov->py0)*ov->stride + (size_t)(n*N-ov->px0);
+    if(g_opt.color_fixed){
+        for(int i=0;i<N;i++, o+=ov->stride){
+            int32_t Yi[8], Cbi[8], Cri[8];
+            if(ints){
+                for(int j=0;j<N;j++){
+                    Yi[j] = sat_u8(blki[0][i][j]+128); Cbi[j] = sat_u8(blki[1][i][j]+128); Cri[j] = sat_u8(blki[2][i][j]+128);
+                }
+            }else{
+                for(int j=0;j<N;j++){
+                    Yi[j] = level_u8(blk[0][i][j]); Cbi[j] = level_u8(blk[1][i][j]); Cri[j] = level_u8(blk[2][i][j]);
+                }
+            }
+            ycbcr_to_rgb_fixed_row(Yi,Cbi,Cri,N,ov->R+o,ov->G+o,ov->B+o);
+        }
+        return;
+    }
+    for(int i=0;i<N;i++, o+=ov->stride){
+        for(int j=0;j<N;j++){
+            double Yv  = blk[0][i][j] + 128.0;
+            double Cbv = blk[1][i][j] + 128.0;
+            double Crv = blk[2][i][j] + 128.0;
+            ycbcr_to_rgb(Yv,Cbv,Crv,&ov->R[o+j],&ov->G[o+j],&ov->B[o+j]);
+        }
+    }
+}
+
+/* =========================================================
+   Method 2 decoder
+   ascii: first line W H, then lines: (m,n,Y|Cb|Cr) skip:val skip:val ...
+   binary: "M2B0" + W,H,bw,bh (int32), then for each block and channel:
+           uint16 pc + pc*(int16 skip,int16 val)
+           or progressive "M2P0" (see decode_m2_progressive)
+           or indexed "M2X0" (see decode_m2_indexed)
+           or lossless "M2L0" (see decode_m2_lossless)
+           or sequence "M2S0" (see decode_m2_sequence)
+           or dedup "M2D0" (see decode_m2_dedup)
+========================================================= */
+// binary record: uint16 pc + pc*(int16 skip,int16 val); zz must be zeroed
+static void read_m2_record(FILE* f, int16_t zz[64]){
+    uint16_t pc=0;
+    if(fread(&pc,2,1,f)!=1) die("method2 bin: read pc fail");
+    int k=0;
+    for(uint16_t i=0;i<pc;i++){
+        Pair pr;
+        if(fread(&pr,sizeof(Pair),1,f)!=1) die("method2 bin: read pair fail");
+        k += pr.skip;
+        if(k>=64) die("method2 bin: RLE overflow");
+        zz[k++] = pr.val;
+    }
+}
+
+static int parse_line_header(TxtIn* t, int* m, int* n, char ch[4]){
+    // expects "(m,n,CH)" where CH is Y or Cb or Cr
+    // return 1 ok, 0 fail
+    if(txt_getc(t)!='(') return 0;
+    if(!txt_read_int(t,m) || txt_getc(t)!=',') return 0;
+    if(!txt_read_int(t,n) || txt_getc(t)!=',') return 0;
+    int k=0, c;
+    while((c=txt_getc(t))!=')'){
+        if(c==EOF || c=='\n' || k==3) return 0;
+        ch[k++]=(char)c;
+    }
+    ch[k]='\0';
+    return 1;
+}
+
+/* Progressive "M2P0": W,H,bw,bh (int32) + nscans(u8), then per scan
+   ks(u8) ke(u8) scan_bytes(u32) + per block/channel uint8 pc + pairs (skip from ks).
+   "M2P1" has scan_bytes as u64.
+   With --scans N only the first N scans are read; missing bands stay zero. */
+/* ---- Lossless payload "M2L0" ----
+   Same header and records as M2B0, but the channels are YCoCg-R after the
+   reversible lifting DCT, unquantized, in the full zigzag order ZZ_FULL. */
+static const uint8_t ZZ_FULL[64] = {
+     0, 1, 8,16, 9, 2, 3,10,17,24,32,25,18,11, 4, 5,
+    12,19,26,33,40,48,41,34,27,20,13, 6, 7,14,21,28,
+    35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,
+    58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63
+};
+
+static void put_block_lossless(const int16_t zz[3][64], int m, int n, OutView* ov){
+    int32_t b[3][8][8];
+    for(int c=0;c<3;c++){
+        int32_t* f = &b[c][0][0];
+        for(int k=0;k<64;k++) f[ZZ_FULL[k]] = zz[c][k];
+        lift_idct8x8(b[c]);
+    }
+    size_t o = (size_t)(m*8-ov->py0)*ov->stride + (size_t)(n*8-ov->px0);
+    for(int i=0;i<8;i++, o+=ov->stride){
+        for(int j=0;j<8;j++){
+            int32_t r,g,bl;
+            ycocg_r_to_rgb(b[0][i][j]+128, b[1][i][j], b[2][i][j], &r,&g,&bl);
+            ov->R[o+j]=(uint8_t)sat_u8(r); ov->G[o+j]=(uint8_t)sat_u8(g); ov->B[o+j]=(uint8_t)sat_u8(bl);
+        }
+    }
+}
+
+static void decode_m2_lossless(FILE* f, const uint8_t hdr54[54]){
+    int32_t hdr[4];
+    if(fread(hdr,sizeof(hdr),1,f)!=1) die("method2 lossless: read header fail");
+    int W=hdr[0], H=hdr[1], bw=hdr[2], bh=hdr[3];
+    if(!block_dims_ok(W,H,bw,bh)) die("method2 lossless: bad dimensions");
+    if(g_opt.scale!=1) die("method2 lossless: --scale needs a quantized DCT payload");
+
+    OutView ov;
+    out_view_init(&ov,W,H);
+    int last_row = out_view_last_row(&ov);
+    int16_t prevDC[3]={0,0,0};
+    for(int m=0;m<bh && m<=last_row;m++){
+        for(int n=0;n<bw;n++){
+            int16_t zz[3][64]={{0}};
+            for(int c=0;c<3;c++){
+                read_m2_record(f,zz[c]);
+                prevDC[c] = (int16_t)(prevDC[c] + zz[c][0]);
+                zz[c][0] = prevDC[c];
+            }
+            if(out_view_row(&ov,m) && out_view_col(&ov,n)) put_block_lossless(zz,m,n,&ov);
+        }
+    }
+    out_view_write(&ov,hdr54);
+}
+
+static void decode_m2_progressive(FILE* f, int wide, const uint8_t hdr54[54]){
+    int32_t hdr[4];
+    uint8_t nscans=0;
+    if(fread(hdr,sizeof(hdr),1,f)!=1) die("method2 prog: read header fail");
+    if(fread(&nscans,1,1,f)!=1) die("method2 prog: read nscans fail");
+    int W=hdr[0], H=hdr[1], bw=hdr[2], bh=hdr[3];
+    if(!block_dims_ok(W,H,bw,bh)) die("method2 prog: bad dimensions");
+
+    size_t nblk=(size_t)bw*bh;
+    int16_t (*coef)[3][64] = (int16_t(*)[3][64])calloc(nblk, sizeof(*coef));
+    if(!coef) die("OOM");
+
+    int use = (g_opt.scans>0 && g_opt.scans<nscans) ? g_opt.scans : nscans;
+    for(int s=0;s<use;s++){
+        uint8_t band[2];
+        uint64_t nbytes=0;
+        if(fread(band,1,2,f)!=2) die("method2 prog: read scan band fail");
+        if(!read_size(f,wide,&nbytes)) die("method2 prog: read scan size fail");
+        int ks=band[0], ke=band[1];
+        if(ks>ke || ke>63) die("method2 prog: bad scan band");
+        for(size_t b=0;b<nblk;b++){
+            for(int c=0;c<3;c++){
+                uint8_t pc=0;
+                if(fread(&pc,1,1,f)!=1) die("method2 prog: read pc fail");
+                int k=ks;
+                for(int i=0;i<pc;i++){
+                    Pair pr;
+                    if(fread(&pr,sizeof(Pair),1,f)!=1) die("method2 prog: read pair fail");
+                    k += pr.skip;
+                    if(k>ke) die("method2 prog: RLE overflow");
+                    coef[b][c][k++] = pr.val;
+                }
+            }
+        }
+    }
+
+    // DC inverse DPCM (DC scan is always first)
+    int16_t prevDC[3]={0,0,0};
+    for(size_t b=0;b<nblk;b++){
+        for(int c=0;c<3;c++){
+            prevDC[c] = (int16_t)(prevDC[c] + coef[b][c][0]);
+            coef[b][c][0] = prevDC[c];
+        }
+    }
+
+    OutView ov;
+    out_view_init(&ov,W,H);
+    for(int m=0;m<bh;m++){
+        if(!out_view_row(&ov,m)) continue;
+        for(int n=0;n<bw;n++){
+            if(out_view_col(&ov,n)) put_block_rgb(coef[(size_t)m*bw+n],m,n,&ov);
+        }
+    }
+    out_view_write(&ov,hdr54);
+    free(coef);
+}
+
+/* Indexed "M2X0": W,H,bw,bh (int32) + M2B0 block records, then trailer
+   bh*(row_offset u64, prevDC Y/Cb/Cr int16) + index_offset(u64).
+   Only block rows inside the view are read: seek to the row, restore prevDC. */
+static void decode_m2_indexed(FILE* f, const uint8_t hdr54[54]){
+    // the index sits at the end of the stream (inputs are memory streams, so
+    // a piped code file is seekable as well)
+    int32_t hdr[4];
+    if(fread(hdr,sizeof(hdr),1,f)!=1) die("method2 idx: read header fail");
+    int W=hdr[0], H=hdr[1], bw=hdr[2], bh=hdr[3];
+    if(!block_dims_ok(W,H,bw,bh)) die("method2 idx: bad dimensions");
+
+    uint64_t idx_pos=0;
+    if(fseeko(f,-8,SEEK_END)!=0 || fread(&idx_pos,8,1,f)!=1) die("method2 idx: read trailer fail");
+    if(idx_pos > (uint64_t)INT64_MAX || fseeko(f,(off_t)idx_pos,SEEK_SET)!=0) die("method2 idx: seek index fail");
+    uint64_t* row_off = (uint64_t*)malloc(sizeof(uint64_t)*(size_t)bh);
+    int16_t (*row_dc)[3] = (int16_t(*)[3])malloc(sizeof(*row_dc)*(size_t)bh);
+    if(!row_off || !row_dc) die("OOM");
+    for(int m=0;m<bh;m++){
+        if(fread(&row_off[m],8,1,f)!=1 || fread(row_dc[m],sizeof(row_dc[m]),1,f)!=1)
+            die("method2 idx: read index fail");
+    }
+
+    OutView ov;
+    out_view_init(&ov,W,H);
+    int last_col=0;
+    for(int n=0;n<bw;n++) if(out_view_col(&ov,n)) last_col=n;
+
+    for(int m=0;m<bh;m++){
+        if(!out_view_row(&ov,m)) continue;
+        if(row_off[m] > (uint64_t)INT64_MAX || fseeko(f,(off_t)row_off[m],SEEK_SET)!=0) die("method2 idx: seek row fail");
+        int16_t prevDC[3];
+        memcpy(prevDC,row_dc[m],sizeof(prevDC));
+        for(int n=0;n<=last_col;n++){
+            int16_t zz[3][64]={{0}};
+            for(int c=0;c<3;c++){
+                read_m2_record(f,zz[c]);
+                prevDC[c] = (int16_t)(prevDC[c] + zz[c][0]);
+                zz[c][0] = prevDC[c];
+            }
+            if(out_view_col(&ov,n)) put_block_rgb(zz,m,n,&ov);
+        }
+    }
+    out_view_write(&ov,hdr54);
+    free(row_off);
+    free(row_dc);
+}
+
+/* Sequence "M2S0": W,H,bw,bh (int32) + frame(u32, 0 = key frame) + flags(u8), then
+   per block kind(u8): 0 = the reference block, 1 = M2B0 records (DC DPCM over
+   kind-1 blocks), 2 = records of the difference to the reference block.
+   The reference is the last frame this context decoded; every block is parsed
+   to keep it current, only those inside the view are reconstructed. */
+typedef struct {
+    int valid;              // cleared while a frame is decoded and after a failed call
+    int W, H;
+    uint32_t frame;
+    int16_t (*zz)[3][64];   // absolute zigzag coefficients per block
+} SeqRef;
+
+static SeqRef* ctx_seq(void); // the context's, see below
+
+static void decode_m2_sequence(FILE* f, const uint8_t hdr54[54]){
+    int32_t hdr[4];
+    uint32_t frame=0;
+    uint8_t flags=0;
+    if(fread(hdr,sizeof(hdr),1,f)!=1 || fread(&frame,4,1,f)!=1 || fread(&flags,1,1,f)!=1)
+        die("method2 seq: read header fail");
+    int W=hdr[0], H=hdr[1], bw=hdr[2], bh=hdr[3];
+    if(!block_dims_ok(W,H,bw,bh)) die("method2 seq: bad dimensions");
+
+    SeqRef* s = ctx_seq();
+    if(frame==0){
+        if(s->W!=W || s->H!=H || !s->zz){
+            // context-owned, outside the call's block list
+            (free)(s->zz);
+            memset(s, 0, sizeof(*s));
+            s->zz = (int16_t(*)[3][64])(malloc)((size_t)bw*bh*sizeof(*s->zz));
+            if(!s->zz) die("OOM");
+            s->W=W; s->H=H;
+        }
+    }else if(!s->valid || s->W!=W || s->H!=H || frame!=s->frame+1){
+        char msg[120];
+        snprintf(msg, sizeof(msg), "method2 seq: frame %u needs frame %u of the series decoded just before", frame, frame-1);
+        die(msg);
+    }
+    s->valid = 0;
+
+    OutView ov;
+    out_view_init(&ov,W,H);
+    int16_t prevDC[3]={0,0,0};
+    for(int m=0;m<bh;m++){
+        for(int n=0;n<bw;n++){
+            int16_t (*ref)[64] = s->zz[(size_t)m*bw+n];
+            uint8_t kind;
+            if(fread(&kind,1,1,f)!=1) die("method2 seq: read block kind fail");
+            if(kind>2 || (frame==0 && kind!=1) || (kind==2 && !(flags&1))) die("method2 seq: bad block kind");
+            if(kind){
+                int16_t zz[3][64]={{0}};
+                for(int c=0;c<3;c++){
+                    read_m2_record(f,zz[c]);
+                    if(kind==1){
+                        prevDC[c] = (int16_t)(prevDC[c] + zz[c][0]);
+                        zz[c][0] = prevDC[c];
+                    }else{
+                        for(int k=0;k<64;k++) zz[c][k] = (int16_t)(zz[c][k] + ref[c][k]);
+                    }
+                }
+                memcpy(ref, zz, sizeof(zz));
+            }
+            if(out_view_row(&ov,m) && out_view_col(&ov,n)) put_block_rgb((const int16_t(*)[64])ref,m,n,&ov);
+        }
+    }
+    s->frame = frame;
+    s->valid = 1;
+    out_view_write(&ov,hdr54);
+}
+
+/* Dedup "M2D0": W,H,bw,bh (int32) + slot_bits(u8), then per block tag(u16):
+   0 = M2B0 records (DC DPCM over tag-0 blocks), after which the block takes slot
+   dedup_slot(coefficients); slot+1 = a repeat of the block in that slot.
+   A repeat copies the pixels of the slot's block when that one is in the view
+   (no IDCT); otherwise it is reconstructed once and the slot points to it. */
+typedef struct {
+    int used, drawn;        // drawn: block (m,n) is in the output view
+    int m, n;
+    int16_t zz[3][64];
+} DedupSlot;
+
+// FNV-1a, folded to bits (same function as mmsp_enc.c)
+static uint32_t dedup_slot(const void* p, size_t n, int bits){
+    const uint8_t* b = (const uint8_t*)p;
+    uint32_t h = 2166136261u;
+    for(size_t i=0;i<n;i++){ h ^= b[i]; h *= 16777619u; }
+    return (h ^ (h >> bits) ^ (h >> 2*bits)) & ((1u<<bits)-1);
+}
+
+// N x N output block (sm,sn) -> (m,n); both lie wholly inside the padded planes
+static void out_view_copy_block(OutView* ov, int sm, int sn, int m, int n){
+    int N = 8/ov->scale;
+    size_t so = (size_t)(sm*N-ov->py0)*ov->stride + (size_t)(sn*N-ov->px0);
+    size_t o  = (size_t)(m*N-ov->py0)*ov->stride + (size_t)(n*N-ov->px0);
+    for(int i=0;i<N;i++, so+=ov->stride, o+=ov->stride){
+        memcpy(ov->R+o, ov->R+so, N); memcpy(ov->G+o, ov->G+so, N); memcpy(ov->B+o, ov->B+so, N);
+    }
+}
+
+static void decode_m2_dedup(FILE* f, const uint8_t hdr54[54]){
+    int32_t hdr[4];
+    uint8_t bits=0;
+    if(fread(hdr,sizeof(hdr),1,f)!=1 || fread(&bits,1,1,f)!=1) die("method2 dedup: read header fail");
+    int W=hdr[0], H=hdr[1], bw=hdr[2], bh=hdr[3];
+    if(!block_dims_ok(W,H,bw,bh)) die("method2 dedup: bad dimensions");
+    if(bits<1 || bits>15) die("method2 dedup: bad slot bits");
+    size_t nslot = (size_t)1<<bits;
+    DedupSlot* slot = (DedupSlot*)calloc(nslot, sizeof(DedupSlot));
+    if(!slot) die("OOM");
+
+    OutView ov;
+    out_view_init(&ov,W,H);
+    int last_row = out_view_last_row(&ov);
+    int16_t prevDC[3]={0,0,0};
+    for(int m=0;m<bh && m<=last_row;m++){
+        for(int n=0;n<bw;n++){
+            int in_view = out_view_row(&ov,m) && out_view_col(&ov,n);
+            uint16_t tag;
+            if(fread(&tag,2,1,f)!=1) die("method2 dedup: read block tag fail");
+            if(tag){
+                if((size_t)tag>nslot || !slot[tag-1].used) die("method2 dedup: reference to an empty slot");
+                if(!in_view) continue;
+                DedupSlot* sl = &slot[tag-1];
+                if(sl->drawn){
+                    out_view_copy_block(&ov, sl->m, sl->n, m, n);
+                }else{
+                    put_block_rgb((const int16_t(*)[64])sl->zz,m,n,&ov);
+                    sl->m=m; sl->n=n; sl->drawn=1;
+                }
+                continue;
+            }
+            int16_t zz[3][64]={{0}};
+            for(int c=0;c<3;c++){
+                read_m2_record(f,zz[c]);
+                prevDC[c] = (int16_t)(prevDC[c] + zz[c][0]);
+                zz[c][0] = prevDC[c];
+            }
+            DedupSlot* sl = &slot[dedup_slot(zz, sizeof(zz), bits)];
+            sl->used=1; sl->drawn=in_view; sl->m=m; sl->n=n;
+            memcpy(sl->zz, zz, sizeof(zz));
+            if(in_view) put_block_rgb(zz,m,n,&ov);
+        }
+    }
+    free(slot);
+    out_view_write(&ov,hdr54);
+}
+
+// Decodes one Method-2 stream from f (an input or an in-memory payload) and closes it.
+static void decode_method2_stream(int is_ascii, FILE* f,
+                                  const uint8_t hdr54[54], int W_from_dim, int H_from_dim, int has_dim_WH){
+    int is_bin   = !is_ascii;
+
+    TxtIn* tin = NULL;
+
+    int W=0,H=0;
+    int bw=0,bh=0;
+
+    if(is_ascii){
+        tin = txt_in_wrap(f);
+        if(!txt_read_int(tin,&W) || !txt_read_int(tin,&H)) die("method2 ascii: missing W H");
+        if(!dims_ok(W,H)) die("method2 ascii: bad dimensions");
+        // consume endline after header
+        txt_skip_line(tin);
+    }else{
+        char magic[4];
+        if(fread(magic,1,4,f)!=4) die("method2 bin: short read magic");
+        if(memcmp(magic,"M2P0",4)==0 || memcmp(magic,"M2P1",4)==0 || memcmp(magic,"M2X0",4)==0 || memcmp(magic,"M2L0",4)==0 || memcmp(magic,"M2S0",4)==0 || memcmp(magic,"M2D0",4)==0){
+            if(magic[2]=='P') decode_m2_progressive(f,magic[3]=='1',hdr54);
+            else if(magic[2]=='L') decode_m2_lossless(f,hdr54);
+            else if(magic[2]=='S') decode_m2_sequence(f,hdr54);
+            else if(magic[2]=='D') decode_m2_dedup(f,hdr54);
+            else decode_m2_indexed(f,hdr54);
+            in_close(f);
+            return;
+        }
+        if(memcmp(magic,"M2B0",4)!=0) die("method2 bin: bad magic");
+        int32_t iW,iH,iBW,iBH;
+        if(fread(&iW,4,1,f)!=1) die("method2 bin: read W fail");
+        if(fread(&iH,4,1,f)!=1) die("method2 bin: read H fail");
+        if(fread(&iBW,4,1,f)!=1) die("method2 bin: read bw fail");
+        if(fread(&iBH,4,1,f)!=1) die("method2 bin: read bh fail");
+        W=iW; H=iH; bw=iBW; bh=iBH;
+        if(!block_dims_ok(W,H,bw,bh)) die("method2 bin: bad dimensions");
+    }
+
+    // If caller provides dim W/H, ensure consistent (helps catch mismatch)
+    if(has_dim_WH){
+        if(W!=W_from_dim || H!=H_from_dim){
+            // still allow but warn
+            report("WARN: rle header W/H (%d,%d) != dim W/H (%d,%d)\n", W,H, W_from_dim,H_from_dim);
+        }
+    }
+
+    if(!is_bin){
+        bw = (W+7)/8;
+        bh = (H+7)/8;
+    }
+
+    OutView ov;
+    out_view_init(&ov,W,H);
+    int last_row = out_view_last_row(&ov);
+
+    int16_t prevDC[3]={0,0,0};
+
+    // For each block, we must read 3 channels in order Y, Cb, Cr (as encoder writes).
+    // Without an index every block up to the last needed row is parsed; only
+    // blocks inside the view are reconstructed.
+    for(int m=0;m<bh && m<=last_row;m++){
+        for(int n=0;n<bw;n++){
+            int16_t zz[3][64]={{0}};
+            for(int c=0;c<3;c++){
+                if(is_ascii){
+                    int mm, nn; char ch[4];
+                    if(txt_peek(tin)==EOF) die("method2 ascii: unexpected EOF line");
+                    if(!parse_line_header(tin,&mm,&nn,ch)) die("method2 ascii: bad line header");
+                    // sanity: block index should match expected traversal
+                    // allow mismatch but warn
+                    if(mm!=m || nn!=n){
+                        report("WARN: ascii block index mismatch: got (%d,%d) expected (%d,%d)\n", mm,nn,m,n);
+                    }
+
+                    // channel order check
+                    const char* expect = (c==0)?"Y":(c==1)?"Cb":"Cr";
+                    if(strcmp(ch,expect)!=0){
+                        report("WARN: ascii channel mismatch: got %s expect %s at block(%d,%d)\n", ch,expect,m,n);
+                    }
+
+                    // parse tokens "skip:val" up to the end of the line; lines have no length limit
+                    int k=0;
+                    for(;;){
+                        txt_skip_blanks(tin);
+                        int nc = txt_peek(tin);
+                        if(nc=='\n' || nc==EOF) break;
+                        int skip=0, val=0;
+                        if(!txt_read_int(tin,&skip) || txt_getc(tin)!=':' || !txt_read_int(tin,&val)) break;
+                        k += skip;
+                        if(k>=64) break;
+                        zz[c][k++] = (int16_t)val;
+                    }
+                    txt_skip_line(tin);
+                }else{
+                    read_m2_record(f,zz[c]);
+                }
+
+                // DC inverse DPCM: zz[0] is diff; actual_dc = prevDC + diff
+                int16_t diff = zz[c][0];
+                int16_t dc = (int16_t)(prevDC[c] + diff);
+                prevDC[c] = dc;
+                zz[c][0] = dc;
+            }
+
+            if(out_view_row(&ov,m) && out_view_col(&ov,n)) put_block_rgb(zz,m,n,&ov);
+        }
+    }
+
+    if(tin) txt_in_close(tin);
+    else in_close(f);
+    out_view_write(&ov,hdr54);
+}
+
+// We need HDR54 for output; the method2/3/4/5 inputs don't include dim, so the
+// caller may pass dim.txt in the parameters (the CLI reads it from the cwd) to
+// reproduce the original header. Otherwise a standard 24-bit header is built.
+static void load_output_hdr54(uint8_t hdr54[54], int* W, int* H, int* has_dim){
+    if(g_opt.dim.len){
+        read_dim_and_hdr54(stream_open(g_opt.dim.data,g_opt.dim.len,"dim.txt"),W,H,hdr54);
+        *has_dim=1;
+    }else{
+        // fallback: minimal valid 24-bit BMP header; W/H will be taken from rle header
+        // We'll fill later after reading rle; easiest is to set a basic template now:
+        uint8_t tmp[54]={
+            0x42,0x4D,0,0,0,0,0,0,0,0,54,0,0,0,
+            40,0,0,0,0,0,0,0,0,0,0,0,1,0,24,0,
+            0,0,0,0,0,0,0,0,0xC4,0x0E,0,0,0xC4,0x0E,0,0,0,0,0,0,0,0,0,0
+        };
+        memcpy(hdr54,tmp,54);
+        *has_dim=0;
+    }
+}
+
+static void decode_method2(void){
+    if(g_call->nin!=1) fail(MMSP_ERR_ARG, "Method-2: input is rle_code");
+
+    uint8_t hdr54[54]={0};
+    int W=0,H=0, has_dim=0;
+    load_output_hdr54(hdr54,&W,&H,&has_dim);
+
+    decode_method2_stream(g_opt.ascii,in_open(0,"rle_code"),hdr54,W,H,has_dim);
+}
+
+/* =========================================================
+   Method 3 Huffman decode
+   - Decode Huffman -> payload bytes (this payload is Method-2 binary file bytes)
+   - Then run the Method-2 binary decoder on that payload (memory stream).
+   inputs: codebook.txt huffman_code.(txt|bin)
+========================================================= */
+typedef struct HNode {
+    int is_leaf;
+    int sym;
+    struct HNode* zero;
+    struct HNode* one;
+} HNode;
+
+static HNode* hn_new(void){
+    HNode* n=(HNode*)calloc(1,sizeof(HNode));
+    if(!n) die("OOM");
+    return n;
+}
+static void hn_free(HNode* n){
+    if(!n) return;
+    hn_free(n->zero);
+    hn_free(n->one);
+    free(n);
+}
+
+// Huffman table used by the encoder (recorded in codebook "table" line and stream header)
+enum { HUF_TABLE_OPTIMAL=0, HUF_TABLE_STATIC=1, HUF_TABLE_SAMPLED=2 };
+static const char* HUF_TABLE_NAME[3] = { "optimal", "static", "sampled" };
+
+static int huf_table_from_name(const char* name){
+    for(int t=0;t<3;t++) if(strcmp(name,HUF_TABLE_NAME[t])==0) return t;
+    die("method3: unknown Huffman table");
+    return -1;
+}
+
+static HNode* load_codebook_build_trie(FILE* f, size_t* payload_size_out, int* table_out){
+
+    char line[4096];
+
+    // line1: M3_BYTE_HUFFMAN
+    if(!fgets(line,sizeof(line),f)) die("codebook: empty");
+    // line2: payload_size N
+    if(!fgets(line,sizeof(line),f)) die("codebook: missing payload_size");
+    size_t payload_size=0;
+    if(sscanf(line,"payload_size %zu",&payload_size)!=1) die("codebook: parse payload_size failed");
+
+    // line3: unique K
+    if(!fgets(line,sizeof(line),f)) die("codebook: missing unique");
+
+    HNode* root = hn_new();
+    *table_out = HUF_TABLE_OPTIMAL;
+
+    // remaining: optional "table NAME [N]", then sym freq code
+    while(fgets(line,sizeof(line),f)){
+        char tname[16];
+        if(sscanf(line,"table %15s",tname)==1){
+            *table_out = huf_table_from_name(tname);
+            continue;
+        }
+        int sym=0;
+        unsigned long long freq=0;
+        char code[2048]={0};
+        if(sscanf(line,"%d %llu %2047s",&sym,&freq,code)==3){
+            if(sym<0 || sym>255) die("codebook: sym out of range");
+            HNode* cur=root;
+            for(char* p=code; *p; p++){
+                if(*p=='0'){
+                    if(!cur->zero) cur->zero=hn_new();
+                    cur=cur->zero;
+                }else if(*p=='1'){
+                    if(!cur->one) cur->one=hn_new();
+                    cur=cur->one;
+                }else{
+                    die("codebook: code contains non 0/1");
+                }
+            }
+            cur->is_leaf=1;
+            cur->sym=sym;
+        }
+    }
+
+    in_close(f);
+    *payload_size_out = payload_size;
+    return root;
+}
+
+static uint8_t* huffman_decode_ascii_bits(TxtIn* t, HNode* root, size_t want_bytes){
+    uint8_t* out=(uint8_t*)malloc(want_bytes);
+    if(!out) die("OOM");
+    size_t outLen=0;
+
+    HNode* cur=root;
+    int ch;
+    while(outLen < want_bytes && (ch=txt_getc(t))!=EOF){
+        if(ch!='0' && ch!='1') continue;
+        cur = (ch=='0')? cur->zero : cur->one;
+        if(!cur) die("method3: invalid bitstream (hit NULL)");
+        if(cur->is_leaf){
+            out[outLen++] = (uint8_t)cur->sym;
+            cur = root;
+        }
+    }
+    if(outLen != want_bytes) die("method3: decoded bytes != payload_size");
+    return out;
+}
+
+// Decodes up to want bytes from an MSB-first bitstream; returns the count decoded.
+static size_t huffman_walk_bits(const uint8_t* data, size_t valid_bits, HNode* root, uint8_t* out, size_t want){
+    size_t outLen=0;
+    HNode* cur=root;
+    for(size_t i=0;i<valid_bits && outLen<want;i++){
+        uint8_t byte = data[i/8];
+        int bit = (byte >> (7-(i%8))) & 1;
+        cur = bit? cur->one : cur->zero;
+        if(!cur) die("huffman: invalid bitstream (hit NULL)");
+        if(cur->is_leaf){
+            out[outLen++] = (uint8_t)cur->sym;
+            cur=root;
+        }
+    }
+    return outLen;
+}
+
+// *in_bytes: stream size (header + bits), known without ftell so pipes work
+static uint8_t* huffman_decode_binary(FILE* f, HNode* root, size_t want_bytes, int cb_table, size_t* in_bytes){
+    // binary header: "M3B0" + payload_size(u32)+padbits(u8)+bit_bytes(u32)+data
+    //                "M3B1" + table(u8) + the same fields
+    //                "M3B2" / "M3B3": as M3B0 / M3B1 with payload_size and bit_bytes u64
+    char magic[4];
+    if(fread(magic,1,4,f)!=4) die("m3 bin: read magic fail");
+    if(memcmp(magic,"M3B",3)!=0 || magic[3]<'0' || magic[3]>'3') die("m3 bin: bad magic");
+    int has_table = (magic[3]-'0') & 1, wide = (magic[3]-'0') >> 1;
+    int table = HUF_TABLE_OPTIMAL;
+    if(has_table){
+        uint8_t tb=0;
+        if(fread(&tb,1,1,f)!=1) die("m3 bin: read table fail");
+        if(tb>HUF_TABLE_SAMPLED) die("m3 bin: bad table");
+        table = tb;
+    }
+    if(table != cb_table) die("method3: codebook and stream use different Huffman tables");
+    uint64_t psz=0, bit_bytes=0;
+    uint8_t padbits=0;
+    if(!read_size(f,wide,&psz)) die("m3 bin: read payload_size fail");
+    if(fread(&padbits,1,1,f)!=1) die("m3 bin: read padbits fail");
+    if(!read_size(f,wide,&bit_bytes)) die("m3 bin: read bit_bytes fail");
+
+    (void)psz; // we trust codebook payload_size as truth
+    if(bit_bytes > in_left(f)) die("m3 bin: read data short");
+    *in_bytes = 4 + has_table + (wide ? 17 : 9) + (size_t)bit_bytes;
+    uint8_t* data=(uint8_t*)malloc((size_t)bit_bytes);
+    if(!data) die("OOM");
+    if(fread(data,1,(size_t)bit_bytes,f)!=bit_bytes) die("m3 bin: read data short");
+
+    uint8_t* out=(uint8_t*)malloc(want_bytes);
+    if(!out) die("OOM");
+    size_t outLen=0;
+
+    if(padbits>7) die("m3 bin: bad padbits");
+    if(bit_bytes > SIZE_MAX/8) die("OOM");
+    size_t total_bits = (size_t)bit_bytes*8;
+    if(total_bits < padbits) die("m3 bin: bit length bad");
+    size_t valid_bits = total_bits - padbits;
+
+    outLen = huffman_walk_bits(data, valid_bits, root, out, want_bytes);
+
+    free(data);
+    if(outLen != want_bytes) die("method3: decoded bytes != payload_size");
+    return out;
+}
+
+/* ================= Compact eF residuals (Method 1) ================= */
+// After the "EFC0" magic: K(u8) + count(u64) + used(u16) + used*(sym u8, len u8, code u64)
+// + padbits(u8) + bit_bytes(u64) + data. The Huffman-coded bytes are count int16
+// values round(eF * 2^K), little-endian.
+static float* ef_compact_read(FILE* f, size_t n){
+    uint8_t k=0, pb=0;
+    uint64_t cnt=0, bit_bytes=0;
+    uint16_t used=0;
+    if(fread(&k,1,1,f)!=1 || fread(&cnt,8,1,f)!=1 || fread(&used,2,1,f)!=1) die("eF compact: short header");
+    if(k>15) die("eF compact: bad fraction bits");
+    if(cnt!=n) die("eF compact: coefficient count does not match dim");
+    if(used==0 || used>256) die("eF compact: bad table");
+
+    HNode* root = hn_new();
+    for(int i=0;i<used;i++){
+        uint8_t sym, len; uint64_t bits;
+        if(fread(&sym,1,1,f)!=1 || fread(&len,1,1,f)!=1 || fread(&bits,8,1,f)!=1) die("eF compact: short table");
+        if(len==0 || len>64) die("eF compact: bad code length");
+        HNode* cur=root;
+        for(int b=len-1;b>=0;b--){
+            HNode** next = ((bits>>b)&1) ? &cur->one : &cur->zero;
+            if(!*next) *next=hn_new();
+            cur=*next;
+        }
+        cur->is_leaf=1;
+        cur->sym=sym;
+    }
+    if(fread(&pb,1,1,f)!=1 || fread(&bit_bytes,8,1,f)!=1) die("eF compact: short header");
+    if(pb>7 || bit_bytes*8 < pb) die("eF compact: bad padbits");
+    if(bit_bytes > in_left(f)) die("eF compact: data short read");
+    uint8_t* data=(uint8_t*)malloc((size_t)bit_bytes);
+    int16_t* r=(int16_t*)malloc_n(n,sizeof(int16_t));
+    float* e=(float*)malloc_n(n,sizeof(float));
+    if(!data||!r||!e) die("OOM");
+    if(fread(data,1,(size_t)bit_bytes,f)!=bit_bytes) die("eF compact: data short read");
+
+    size_t nb = n*sizeof(int16_t);
+    if(huffman_walk_bits(data, (size_t)bit_bytes*8 - pb, root, (uint8_t*)r, nb)!=nb) die("eF compact: decoded size mismatch");
+    float step = 1.0f/(float)(1<<k);
+    for(size_t i=0;i<n;i++) e[i] = (float)r[i]*step;
+
+    hn_free(root);
+    free(data); free(r);
+    return e;
+}
+
+// payload is the entire Method-2 binary file bytes; the method2 binary decoder reads it
+// through a memory stream (no temp file on disk, and --index payloads stay seekable)
+static void decode_m2_payload(const uint8_t* payload, size_t payload_size){
+    // For output BMP header, prefer the caller's dim.txt (same behavior as method2 decoder)
+    uint8_t hdr54[54]={0};
+    int W=0,H=0, has_dim=0;
+    load_output_hdr54(hdr54,&W,&H,&has_dim);
+
+    decode_method2_stream(0,stream_open(payload,payload_size,"method3: payload"),hdr54,W,H,has_dim);
+}
+
+static void decode_method3(void){
+    if(g_call->nin!=2) fail(MMSP_ERR_ARG, "Method-3: inputs are codebook.txt huffman_code");
+
+    FILE* f = in_open(1,"huffman_code");
+    size_t payload_size=0;
+    int cb_table=0;
+    HNode* root = load_codebook_build_trie(in_open(0,"codebook"), &payload_size, &cb_table);
+
+    uint8_t* payload=NULL;
+    size_t in_bytes=0;
+    double t0 = now_sec();
+
+    if(g_opt.ascii){
+        // skip header lines: M3 [table], payload_size, padbits
+        char line[4096];
+        if(!fgets(line,sizeof(line),f)) die("m3 ascii: missing line1");
+        char tname[16];
+        int st_table = (sscanf(line,"M3 %15s",tname)==1) ? huf_table_from_name(tname) : HUF_TABLE_OPTIMAL;
+        if(st_table != cb_table) die("method3: codebook and stream use different Huffman tables");
+        if(!fgets(line,sizeof(line),f)) die("m3 ascii: missing line2");
+        if(!fgets(line,sizeof(line),f)) die("m3 ascii: missing line3");
+        TxtIn* t = txt_in_wrap(f);
+        payload = huffman_decode_ascii_bits(t, root, payload_size);
+        free(t);
+    }else{
+        payload = huffman_decode_binary(f, root, payload_size, cb_table, &in_bytes);
+    }
+    if(!in_bytes) in_bytes = g_call->in[1].len;
+    in_close(f);
+    hn_free(root);
+    if(g_opt.bench){
+        // W,H sit right after the "M2B0" magic of the decoded payload
+        int32_t wh[2]={0,0};
+        if(payload_size>=12) memcpy(wh, payload+4, sizeof(wh));
+        bench_report("method3 huffman", now_sec()-t0, in_bytes, (long long)wh[0]*wh[1]);
+    }
+
+    decode_m2_payload(payload, payload_size);
+    free(payload);
+}
+
+/* =========================================================
+   Method 4 arithmetic decode
+   input: arith_code.bin
+   binary: "M4A0" + W,H,bw,bh (int32) + code_bytes(u32) + range-coded data
+   ("M4L0": same layout, lossless YCoCg-R lifting coefficients, see put_block_lossless;
+    "M4A1" / "M4L1": code_bytes u64)
+   (model and binarization must match encoder)
+========================================================= */
+#define AC_PROB_BITS 11
+#define AC_PROB_ONE  (1u<<AC_PROB_BITS)
+#define AC_MOVE_BITS 4
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t range, code;
+} RcDec;
+
+static uint8_t rc_next_byte(RcDec* rc){
+    return (rc->p < rc->end) ? *rc->p++ : 0;
+}
+static void rc_dec_init(RcDec* rc, const uint8_t* data, size_t n){
+    rc->p=data; rc->end=data+n;
+    rc->range=0xFFFFFFFFu; rc->code=0;
+    for(int i=0;i<5;i++) rc->code = (rc->code<<8) | rc_next_byte(rc);
+}
+static int rc_dec_bit(RcDec* rc, uint16_t* p){
+    uint32_t bound = (rc->range >> AC_PROB_BITS) * (*p);
+    int bit;
+    if(rc->code < bound){
+        rc->range = bound;
+        *p += (uint16_t)((AC_PROB_ONE - *p) >> AC_MOVE_BITS);
+        bit = 0;
+    }else{
+        rc->code -= bound;
+        rc->range -= bound;
+        *p -= (uint16_t)(*p >> AC_MOVE_BITS);
+        bit = 1;
+    }
+    while(rc->range < (1u<<24)){
+        rc->range <<= 8;
+        rc->code = (rc->code<<8) | rc_next_byte(rc);
+    }
+    return bit;
+}
+
+typedef struct {
+    uint16_t zero[3][64];
+    uint16_t eob[3][64];
+    uint16_t size[3][64][16];
+    uint16_t mant[3][16][16];
+    uint16_t sign[3];
+} CoefModel;
+
+static void coef_model_init(CoefModel* cm){
+    uint16_t* p = (uint16_t*)cm;
+    for(size_t i=0;i<sizeof(*cm)/sizeof(uint16_t);i++) p[i] = AC_PROB_ONE/2;
+}
+
+static int16_t ac_decode_level(RcDec* rc, CoefModel* cm, int c, int k){
+    int nb = 1;
+    while(nb<16 && rc_dec_bit(rc, &cm->size[c][k][nb-1])) nb++;
+    int m = 1;
+    for(int b=nb-2;b>=0;b--) m = (m<<1) | rc_dec_bit(rc, &cm->mant[c][nb-1][b]);
+    return (int16_t)(rc_dec_bit(rc, &cm->sign[c]) ? -m : m);
+}
+
+static void ac_decode_channel(RcDec* rc, CoefModel* cm, int c, int16_t zz[64]){
+    memset(zz, 0, 64*sizeof(int16_t));
+    if(!rc_dec_bit(rc, &cm->zero[c][0])) zz[0] = ac_decode_level(rc, cm, c, 0);
+
+    int k=1;
+    while(k<64){
+        if(rc_dec_bit(rc, &cm->eob[c][k])) break;
+        while(rc_dec_bit(rc, &cm->zero[c][k])){
+            if(++k>=64) die("method4: corrupt stream (zero run past block end)");
+        }
+        zz[k] = ac_decode_level(rc, cm, c, k);
+        k++;
+    }
+}
+
+static CoefModel* ctx_coef_model(void); // the context's, see below
+
+static void decode_method4(void){
+    if(g_call->nin!=1) fail(MMSP_ERR_ARG, "Method-4: input is arith_code");
+
+    uint8_t hdr54[54]={0};
+    int dW=0,dH=0, has_dim=0;
+    load_output_hdr54(hdr54,&dW,&dH,&has_dim);
+
+    FILE* f = in_open(0,"arith_code");
+    char magic[4];
+    if(fread(magic,1,4,f)!=4) die("m4: read magic fail");
+    if(memcmp(magic,"M4",2)!=0 || (magic[2]!='A' && magic[2]!='L') || (magic[3]!='0' && magic[3]!='1'))
+        die("m4: bad magic");
+    int lossless = magic[2]=='L', wide = magic[3]=='1';
+    if(lossless && g_opt.scale!=1) die("m4: --scale needs a quantized DCT payload");
+    int32_t hdr[4];
+    uint64_t nbytes=0;
+    if(fread(hdr,sizeof(hdr),1,f)!=1) die("m4: read header fail");
+    if(!read_size(f,wide,&nbytes)) die("m4: read code_bytes fail");
+    int W=hdr[0], H=hdr[1], bw=hdr[2], bh=hdr[3];
+    if(!block_dims_ok(W,H,bw,bh)) die("m4: bad dimensions");
+    if(has_dim && (W!=dW || H!=dH)){
+        report("WARN: m4 header W/H (%d,%d) != dim W/H (%d,%d)\n", W,H, dW,dH);
+    }
+    if(nbytes > in_left(f)) die("m4: read data short");
+    uint8_t* data = (uint8_t*)malloc(nbytes ? (size_t)nbytes : 1);
+    if(!data) die("OOM");
+    if(fread(data,1,(size_t)nbytes,f)!=nbytes) die("m4: read data short");
+    in_close(f);
+
+    // phase 1: entropy decode all blocks (timed separately for --bench)
+    double t0 = now_sec();
+    size_t nblk = (size_t)bw*bh;
+    int16_t (*coef)[3][64] = (int16_t(*)[3][64])malloc_n(nblk,sizeof(*coef));
+    CoefModel* cm = ctx_coef_model();
+    if(!coef) die("OOM");
+    coef_model_init(cm);
+
+    RcDec rc; rc_dec_init(&rc, data, nbytes);
+    int16_t prevDC[3]={0,0,0};
+    for(size_t b=0;b<nblk;b++){
+        for(int c=0;c<3;c++){
+            ac_decode_channel(&rc, cm, c, coef[b][c]);
+            prevDC[c] = (int16_t)(prevDC[c] + coef[b][c][0]);
+            coef[b][c][0] = prevDC[c];
+        }
+    }
+    double t1 = now_sec();
+    bench_report("method4 arith", t1-t0, nbytes, (long long)W*H);
+
+    // phase 2: reconstruct
+    OutView ov;
+    out_view_init(&ov,W,H);
+    for(int m=0;m<bh;m++){
+        if(!out_view_row(&ov,m)) continue;
+        for(int n=0;n<bw;n++){
+            if(!out_view_col(&ov,n)) continue;
+            if(lossless) put_block_lossless(coef[(size_t)m*bw+n],m,n,&ov);
+            else put_block_rgb(coef[(size_t)m*bw+n],m,n,&ov);
+        }
+    }
+    bench_report("method4 reconstruct", now_sec()-t1, nbytes, (long long)W*H);
+
+    out_view_write(&ov,hdr54);
+    free(coef); free(data);
+}
+
+/* =========================================================
+   Method 5 rANS decode
+   input: rans_code.bin
+   binary: "M5R0" + payload_size(u32)
+           + 2 tables (even/odd bytes): used(u16) + used*(sym u8, freq u16), each summing to 4096
+           + code_bytes(u32) + data
+   ("M5R1": payload_size and code_bytes u64)
+   4 interleaved states: symbol i is decoded from state i%4 with table i%2
+========================================================= */
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1u<<RANS_PROB_BITS)
+#define RANS_L (1u<<23)
+#define RANS_LANES 4
+
+// one lookup per symbol: slot -> (sym, freq, slot - cum[sym])
+typedef struct { uint8_t sym; uint16_t freq; uint16_t bias; } RansSlot;
+
+static uint8_t* rans_decode(const uint8_t* code, size_t code_bytes, const uint16_t nf[2][256], size_t n){
+    RansSlot* tabs = (RansSlot*)malloc(sizeof(RansSlot)*RANS_PROB_SCALE*2);
+    uint8_t* out = (uint8_t*)malloc(n ? n : 1);
+    if(!tabs || !out) die("OOM");
+
+    for(int t=0;t<2;t++){
+        RansSlot* tab = tabs + t*RANS_PROB_SCALE;
+        uint32_t cum=0;
+        for(int s=0;s<256;s++){
+            if(cum + nf[t][s] > RANS_PROB_SCALE) die("m5: frequency table does not sum to 4096");
+            for(uint32_t k=0;k<nf[t][s];k++){
+                tab[cum+k].sym=(uint8_t)s;
+                tab[cum+k].freq=nf[t][s];
+                tab[cum+k].bias=(uint16_t)k;
+            }
+            cum += nf[t][s];
+        }
+        if(cum != RANS_PROB_SCALE) die("m5: frequency table does not sum to 4096");
+    }
+    // lanes 0/2 carry even (low) bytes, lanes 1/3 odd (high) bytes
+    const RansSlot* tlo = tabs;
+    const RansSlot* thi = tabs + RANS_PROB_SCALE;
+
+    const uint8_t* p = code;
+    const uint8_t* end = code + code_bytes;
+    if(code_bytes < 4*RANS_LANES) die("m5: stream too short");
+    uint32_t x[RANS_LANES];
+    for(int l=0;l<RANS_LANES;l++){
+        x[l] = (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+        p += 4;
+    }
+
+    const uint32_t mask = RANS_PROB_SCALE-1;
+    size_t i=0;
+    // main loop: 4 independent lanes per step, renormalization after all lookups
+    if(n >= RANS_LANES){
+        for(; i+RANS_LANES<=n; i+=RANS_LANES){
+            RansSlot e0 = tlo[x[0] & mask];
+            RansSlot e1 = thi[x[1] & mask];
+            RansSlot e2 = tlo[x[2] & mask];
+            RansSlot e3 = thi[x[3] & mask];
+            out[i+0]=e0.sym; out[i+1]=e1.sym; out[i+2]=e2.sym; out[i+3]=e3.sym;
+            x[0] = e0.freq*(x[0]>>RANS_PROB_BITS) + e0.bias;
+            x[1] = e1.freq*(x[1]>>RANS_PROB_BITS) + e1.bias;
+            x[2] = e2.freq*(x[2]>>RANS_PROB_BITS) + e2.bias;
+            x[3] = e3.freq*(x[3]>>RANS_PROB_BITS) + e3.bias;
+            for(int l=0;l<RANS_LANES;l++){
+                while(x[l] < RANS_L){
+                    if(p>=end) die("m5: truncated stream");
+                    x[l] = (x[l]<<8) | *p++;
+                }
+            }
+        }
+    }
+    for(; i<n; i++){
+        uint32_t* st = &x[i % RANS_LANES];
+        RansSlot e = ((i & 1) ? thi : tlo)[*st & mask];
+        out[i] = e.sym;
+        *st = e.freq*(*st>>RANS_PROB_BITS) + e.bias;
+        while(*st < RANS_L){
+            if(p>=end) die("m5: truncated stream");
+            *st = (*st<<8) | *p++;
+        }
+    }
+
+    free(tabs);
+    return out;
+}
+
+static void decode_method5(void){
+    if(g_call->nin!=1) fail(MMSP_ERR_ARG, "Method-5: input is rans_code");
+
+    FILE* f = in_open(0,"rans_code");
+    char magic[4];
+    if(fread(magic,1,4,f)!=4) die("m5: read magic fail");
+    if(memcmp(magic,"M5R0",4)!=0 && memcmp(magic,"M5R1",4)!=0) die("m5: bad magic");
+    int wide = magic[3]=='1';
+    uint64_t psz=0, code_bytes=0;
+    uint16_t nf[2][256];
+    memset(nf,0,sizeof(nf));
+    if(!read_size(f,wide,&psz)) die("m5: read payload_size fail");
+    if(psz > SIZE_MAX) die("OOM");
+    for(int t=0;t<2;t++){
+        uint16_t used=0;
+        if(fread(&used,2,1,f)!=1 || used>256) die("m5: read freq table fail");
+        for(int k=0;k<used;k++){
+            uint8_t sym; uint16_t fr;
+            if(fread(&sym,1,1,f)!=1 || fread(&fr,2,1,f)!=1) die("m5: read freq table fail");
+            nf[t][sym]=fr;
+        }
+    }
+    if(!read_size(f,wide,&code_bytes)) die("m5: read code_bytes fail");
+    if(code_bytes > in_left(f)) die("m5: read data short");
+    uint8_t* code = (uint8_t*)malloc(code_bytes ? (size_t)code_bytes : 1);
+    if(!code) die("OOM");
+    if(fread(code,1,(size_t)code_bytes,f)!=code_bytes) die("m5: read data short");
+    in_close(f);
+
+    double t0 = now_sec();
+    uint8_t* payload = rans_decode(code, (size_t)code_bytes, nf, (size_t)psz);
+    if(g_opt.bench){
+        int32_t wh[2]={0,0};
+        if(psz>=12) memcpy(wh, payload+4, sizeof(wh));
+        bench_report("method5 rans", now_sec()-t0, code_bytes, (long long)wh[0]*wh[1]);
+    }
+    free(code);
+
+    decode_m2_payload(payload, (size_t)psz);
+    free(payload);
+}
+
+
+/* ================= Context ================= */
+struct mmsp_decoder {
+    CoefModel cm;       // Method-4 context models (reset per call)
+    SeqRef seq;         // M2S0 reference frame (kept between calls)
+    char* bmp;          // result of the last call (open_memstream buffer)
+    size_t bmp_len;
+    char* rep;
+    size_t rep_len;
+    char err[200];
+    Call call;          // state of the running call (outlives its setjmp frame)
+};
+
+static CoefModel* ctx_coef_model(void){ return &g_call->dec->cm; }
+static SeqRef* ctx_seq(void){ return &g_call->dec->seq; }
+
+/* ================= API (mmsp.h) ================= */
+mmsp_decoder* mmsp_decoder_create(void){
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_dct);
+    return (mmsp_decoder*)calloc(1, sizeof(mmsp_decoder));
+}
+
+static void release_result(mmsp_decoder* dec){
+    (free)(dec->bmp); // open_memstream buffers
+    (free)(dec->rep);
+    dec->bmp = dec->rep = NULL;
+    dec->bmp_len = dec->rep_len = 0;
+}
+
+void mmsp_decoder_destroy(mmsp_decoder* dec){
+    if(!dec) return;
+    release_result(dec);
+    (free)(dec->seq.zz);
+    free(dec);
+}
+
+const char* mmsp_decoder_error(const mmsp_decoder* dec){
+    return dec->err;
+}
+
+static void (*const DECODE_METHOD[6])(void) = {
+    decode_method0, decode_method1, decode_method2, decode_method3, decode_method4, decode_method5
+};
+
+int mmsp_decode(mmsp_decoder* dec, const mmsp_dec_params* p,
+                const mmsp_buf* in, int nin, mmsp_result* out){
+    release_result(dec);
+    memset(out, 0, sizeof(*out));
+    dec->err[0] = '\0';
+
+    Call* cl = &dec->call;
+    memset(cl, 0, sizeof(*cl));
+    cl->live.l.prev = cl->live.l.next = &cl->live;
+    cl->dec = dec;
+    cl->in = in;
+    cl->nin = nin;
+    g_call = cl;
+
+    if(setjmp(cl->fail)==0){
+        if(nin<0 || (nin && !in)) fail(MMSP_ERR_ARG, "bad input list");
+        set_options(p);
+        DECODE_METHOD[g_opt.method]();
+        cl->status = MMSP_OK;
+    }else{
+        dec->seq.valid = 0; // a half-decoded reference is not usable
+        snprintf(dec->err, sizeof(dec->err), "%s", cl->msg);
+    }
+
+    for(int k=0;k<MAX_STREAMS;k++) if(cl->open[k]) fclose(cl->open[k]);
+    if(cl->out) fclose(cl->out); // sets out_data / out_len
+    if(cl->rep) fclose(cl->rep);
+    // nothing a method allocates outlives the call
+    for(MemHdr* h=cl->live.l.next; h!=&cl->live; ){ MemHdr* nx=h->l.next; (free)(h); h=nx; }
+    if(cl->status!=MMSP_OK){
+        (free)(cl->out_data);
+        (free)(cl->rep_data);
+    }else{
+        dec->bmp = cl->out_data;
+        dec->bmp_len = cl->out_len;
+        dec->rep = cl->rep_data;
+        dec->rep_len = cl->rep_len;
+        out->nparts = 1;
+        out->part[0].data = (const uint8_t*)dec->bmp;
+        out->part[0].len = dec->bmp_len;
+        out->report.data = (const uint8_t*)dec->rep;
+        out->report.len = dec->rep_len;
+    }
+    g_call = NULL;
+    return cl->status;
+}
@@ -0,0 +1,2600 @@
+// mmsp_enc.c  (Methods 0/1/2/3/4/5) — encoder library, API in mmsp.h, CLI in encoder.c
+// MMSP Final Project - buffer-to-buffer encoder for method 0/1/2/3/4/5
+// - Method 0: BMP -> R/G/B txt + dim.txt
+// - Method 1: BMP -> QT txt + dim.txt + qF raw (int16) + eF raw (float32) + print SQNR_Freq (3x64)
+//             or one interleaved coef.raw (M1I0) instead of the six raw files
+//             --ef compact[:K] writes eF as Huffman-coded K-fraction-bit integers (EFC0)
+//             --precision float|int also prints the PSNR against the all-double transform
+// - Method 2: BMP -> RLE (ascii or binary)  [pipeline: RGB->YCbCr->DCT->Quant->DPCM(DC)->ZigZag->RLE]
+// - Method 3: Method2-binary payload -> Huffman (ascii or binary), with codebook.txt
+//             --table optimal (two-pass, default) | static (one-pass) | sampled[:N]
+// - Method 4: Method2 coefficients (DPCM DC + ZigZag) -> adaptive binary arithmetic coding
+// - Method 5: Method2-binary payload -> 4-way interleaved rANS (table-lookup decode)
+// - Methods 2-5: --lossless uses YCoCg-R + a reversible lifting DCT, unquantized (bit-exact)
+// - Methods 1-5: --lambda L picks rate-distortion optimized quantization levels
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "mmsp.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* ========================== BMP ========================== */
+#pragma pack(push,1)
+typedef struct {
+    uint16_t bfType;      // 'BM'
+    uint32_t bfSize;
+    uint16_t bfReserved1;
+    uint16_t bfReserved2;
+    uint32_t bfOffBits;
+} BMPFileHeader;
+
+typedef struct {
+    uint32_t biSize;      // 40
+    int32_t  biWidth;
+    int32_t  biHeight;    // + : bottom-up, - : top-down
+    uint16_t biPlanes;    // 1
+    uint16_t biBitCount;  // 24
+    uint32_t biCompression; // 0
+    uint32_t biSizeImage;
+    int32_t  biXPelsPerMeter;
+    int32_t  biYPelsPerMeter;
+    uint32_t biClrUsed;
+    uint32_t biClrImportant;
+} BMPInfoHeader;
+#pragma pack(pop)
+
+/* ========================== Call state ==========================
+   Every mmsp_encode() runs inside one Call. die() unwinds to it with longjmp;
+   the blocks allocated and the streams opened during the call are tracked, so a
+   failed call releases them and leaves the context usable. */
+typedef union MemHdr {
+    struct { union MemHdr *prev, *next; } l;   // self-linked when not owned by a call
+    max_align_t align;
+} MemHdr;
+
+typedef struct mmsp_encoder mmsp_encoder;
+typedef struct {
+    jmp_buf fail;
+    int status;
+    char msg[200];
+    MemHdr live;                    // blocks allocated during the call
+    mmsp_encoder* enc;
+    FILE* in;                       // input BMP (memory stream)
+    FILE* out[MMSP_MAX_PARTS];      // output parts (open_memstream)
+    char* out_data[MMSP_MAX_PARTS];
+    size_t out_len[MMSP_MAX_PARTS];
+    int nout;
+    FILE* rep;                      // report text
+    char* rep_data;
+    size_t rep_len;
+} Call;
+
+static _Thread_local Call* g_call;
+
+static _Noreturn void fail(int status, const char* msg){
+    if(!g_call) abort(); // every entry point installs a Call first
+    g_call->status = status;
+    snprintf(g_call->msg, sizeof(g_call->msg), "%s", msg);
+    longjmp(g_call->fail, 1);
+}
+static _Noreturn void die(const char* msg){
+    fail(strcmp(msg,"OOM")==0 ? MMSP_ERR_NOMEM : MMSP_ERR_FORMAT, msg);
+}
+
+// malloc/calloc/realloc/free below this point go through the call's block list
+static void mem_link(MemHdr* h){
+    if(g_call){
+        h->l.prev = &g_call->live;
+        h->l.next = g_call->live.l.next;
+        h->l.next->l.prev = h;
+        g_call->live.l.next = h;
+    }else{
+        h->l.prev = h->l.next = h;
+    }
+}
+static void mem_unlink(MemHdr* h){
+    h->l.prev->l.next = h->l.next;
+    h->l.next->l.prev = h->l.prev;
+    h->l.prev = h->l.next = h;
+}
+static int mem_tracked(const void* p){
+    const MemHdr* h = (const MemHdr*)p - 1;
+    return h->l.next != h;
+}
+static void* mem_malloc(size_t n){
+    if(n > SIZE_MAX - sizeof(MemHdr)) return NULL;
+    MemHdr* h = (MemHdr*)(malloc)(sizeof(MemHdr) + n);
+    if(!h) return NULL;
+    mem_link(h);
+    return h + 1;
+}
+static void* mem_calloc(size_t n, size_t size){
+    if(size && n > SIZE_MAX/size) return NULL;
+    void* p = mem_malloc(n*size);
+    if(p) memset(p, 0, n*size);
+    return p;
+}
+static void* mem_realloc(void* p, size_t n){
+    if(!p) return mem_malloc(n);
+    if(n > SIZE_MAX - sizeof(MemHdr)) return NULL;
+    MemHdr* h = (MemHdr*)p - 1;
+    mem_unlink(h);
+    MemHdr* nh = (MemHdr*)(realloc)(h, sizeof(MemHdr) + n);
+    if(!nh){ mem_link(h); return NULL; }
+    mem_link(nh);
+    return nh + 1;
+}
+static void mem_free(void* p){
+    if(!p) return;
+    MemHdr* h = (MemHdr*)p - 1;
+    mem_unlink(h);
+    (free)(h);
+}
+#define malloc(n)    mem_malloc(n)
+#define calloc(n,s)  mem_calloc(n,s)
+#define realloc(p,n) mem_realloc(p,n)
+#define free(p)      mem_free(p)
+
+// n*size bytes, NULL when the product does not fit size_t (callers die "OOM")
+static void* malloc_n(size_t n, size_t size){
+    if(size && n > SIZE_MAX/size) return NULL;
+    return malloc(n*size);
+}
+// grows *cap (doubling from min) until it holds need bytes; 0 on size_t overflow
+static int grow_cap(size_t* cap, size_t need, size_t min){
+    size_t nc = *cap ? *cap : min;
+    while(nc < need){
+        if(nc > SIZE_MAX/2) return 0;
+        nc *= 2;
+    }
+    *cap = nc;
+    return 1;
+}
+
+// output part k of the current call, in command-line order
+static FILE* part_out(int k){
+    Call* cl = g_call;
+    if(!cl->out[k]){
+        cl->out[k] = open_memstream(&cl->out_data[k], &cl->out_len[k]);
+        if(!cl->out[k]) die("OOM");
+        if(k >= cl->nout) cl->nout = k+1;
+    }
+    return cl->out[k];
+}
+// text for the caller's report (the CLI prints it)
+static void report(const char* fmt, ...){
+    Call* cl = g_call;
+    if(!cl->rep){
+        cl->rep = open_memstream(&cl->rep_data, &cl->rep_len);
+        if(!cl->rep) die("OOM");
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(cl->rep, fmt, ap);
+    va_end(ap);
+}
+
+static int row_size_24(int w){ return ((w*3 + 3)/4)*4; }
+
+// forward-only replacement for fseek(f, n, SEEK_CUR)
+static void skip_bytes(FILE* f, long n){
+    uint8_t tmp[256];
+    while(n>0){
+        size_t k = (n>(long)sizeof(tmp)) ? sizeof(tmp) : (size_t)n;
+        if(fread(tmp,1,k,f)!=k) die("unexpected end of input");
+        n -= (long)k;
+    }
+}
+// planes are stored padded to whole 8x8 blocks (see load_bmp_topdown_rgb)
+static int pad8(int v){ return (v+7) & ~7; }
+
+/* ---- BGR(A) row -> R,G,B planes ----
+   Scalar loops plus SSSE3 pshufb kernels (16 pixels per step) on x86 GCC/Clang,
+   picked at run time so the plain CI build still uses them. -DNO_SIMD disables. */
+#if !defined(NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BMP_SIMD_X86 1
+#include <tmmintrin.h>
+#endif
+
+static void split_bgr24_scalar(const uint8_t* row, uint8_t* r, uint8_t* g, uint8_t* b, int x0, int w){
+    for(int x=x0;x<w;x++){
+        b[x] = row[x*3 + 0];
+        g[x] = row[x*3 + 1];
+        r[x] = row[x*3 + 2];
+    }
+}
+static void split_bgra32_scalar(const uint8_t* row, uint8_t* r, uint8_t* g, uint8_t* b, int x0, int w){
+    for(int x=x0;x<w;x++){
+        b[x] = row[x*4 + 0];
+        g[x] = row[x*4 + 1];
+        r[x] = row[x*4 + 2];
+    }
+}
+
+#ifdef BMP_SIMD_X86
+#define Z 0x80
+// SPLIT3[k][v]: gathers channel k (0=B,1=G,2=R) of 16 pixels from the v-th 16-byte chunk
+static const uint8_t SPLIT3[3][3][16] = {
+    {{0,3,6,9,12,15,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z}, {Z,Z,Z,Z,Z,Z,2,5,8,11,14,Z,Z,Z,Z,Z}, {Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,1,4,7,10,13}},
+    {{1,4,7,10,13,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z}, {Z,Z,Z,Z,Z,0,3,6,9,12,15,Z,Z,Z,Z,Z}, {Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,2,5,8,11,14}},
+    {{2,5,8,11,14,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,Z}, {Z,Z,Z,Z,Z,1,4,7,10,13,Z,Z,Z,Z,Z,Z}, {Z,Z,Z,Z,Z,Z,Z,Z,Z,Z,0,3,6,9,12,15}},
+};
+// groups 4 BGRA pixels as B0..B3 G0..G3 R0..R3 A0..A3
+static const uint8_t SPLIT4[16] = {0,4,8,12, 1,5,9,13, 2,6,10,14, 3,7,11,15};
+#undef Z
+
+__attribute__((target("ssse3")))
+static int split_bgr24_ssse3(const uint8_t* row, uint8_t* r, uint8_t* g, uint8_t* b, int w){
+    uint8_t* dst[3] = { b, g, r };
+    __m128i m[3][3];
+    for(int k=0;k<3;k++) for(int v=0;v<3;v++) m[k][v] = _mm_loadu_si128((const __m128i*)SPLIT3[k][v]);
+    int x=0;
+    for(; x+16<=w; x+=16){
+        const uint8_t* p = row + x*3;
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(p +  0));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i*)(p + 32));
+        for(int k=0;k<3;k++){
+            __m128i o = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a0,m[k][0]), _mm_shuffle_epi8(a1,m[k][1])),
+                                     _mm_shuffle_epi8(a2,m[k][2]));
+            _mm_storeu_si128((__m128i*)(dst[k] + x), o);
+        }
+    }
+    return x;
+}
+
+__attribute__((target("ssse3")))
+static int split_bgra32_ssse3(const uint8_t* row, uint8_t* r, uint8_t* g, uint8_t* b, int w){
+    const __m128i m = _mm_loadu_si128((const __m128i*)SPLIT4);
+    int x=0;
+    for(; x+16<=w; x+=16){
+        const uint8_t* p = row + x*4;
+        __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p +  0)), m);
+        __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), m);
+        __m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), m);
+        __m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), m);
+        // 4x4 transpose of 32-bit lanes: [B G R A] per vector -> one plane per vector
+        __m128i t0 = _mm_unpacklo_epi32(v0,v1), t1 = _mm_unpackhi_epi32(v0,v1);
+        __m128i t2 = _mm_unpacklo_epi32(v2,v3), t3 = _mm_unpackhi_epi32(v2,v3);
+        _mm_storeu_si128((__m128i*)(b + x), _mm_unpacklo_epi64(t0,t2));
+        _mm_storeu_si128((__m128i*)(g + x), _mm_unpackhi_epi64(t0,t2));
+        _mm_storeu_si128((__m128i*)(r + x), _mm_unpacklo_epi64(t1,t3));
+    }
+    return x;
+}
+#endif
+
+// Splits one BMP pixel row (bpp 24 or 32) into the three planes.
+static void split_row(const uint8_t* row, int bpp, uint8_t* r, uint8_t* g, uint8_t* b, int w){
+    int x0 = 0;
+#ifdef BMP_SIMD_X86
+    static int has_ssse3 = -1;
+    if(has_ssse3 < 0) has_ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    if(has_ssse3) x0 = (bpp==32) ? split_bgra32_ssse3(row,r,g,b,w) : split_bgr24_ssse3(row,r,g,b,w);
+#endif
+    if(bpp==32) split_bgra32_scalar(row,r,g,b,x0,w);
+    else split_bgr24_scalar(row,r,g,b,x0,w);
+}
+
+// reads the call's input BMP
+static void load_bmp_topdown_rgb(
+    int* W, int* H,
+    uint8_t** R, uint8_t** G, uint8_t** B,
+    uint8_t header54[54], int* has_header54
+){
+    FILE* f = g_call->in;
+
+    // the 54-byte header is read once and kept for exact reproduction;
+    // everything after it is consumed in order (no seeks)
+    BMPFileHeader fh;
+    BMPInfoHeader ih;
+    if(fread(header54,1,54,f)!=54) die("BMP read header failed");
+    memcpy(&fh, header54, sizeof(fh));
+    memcpy(&ih, header54+sizeof(fh), sizeof(ih));
+    *has_header54 = 1;
+    long pos = 54;
+
+    if(fh.bfType != 0x4D42) die("Not a BMP");
+    // 24-bit BI_RGB, or 32-bit BGRA (BI_RGB or BI_BITFIELDS with the standard masks)
+    int bpp = ih.biBitCount;
+    if(bpp==32 && ih.biCompression==3){
+        uint32_t masks[3];
+        if(fread(masks,4,3,f)!=3) die("BMP read bitfield masks failed");
+        pos += 12;
+        if(masks[0]!=0x00FF0000u || masks[1]!=0x0000FF00u || masks[2]!=0x000000FFu)
+            die("Only BGRA channel order supported for 32-bit BMP");
+    }else if(!((bpp==24 || bpp==32) && ih.biCompression==0)){
+        die("Only 24-bit or 32-bit uncompressed BMP supported");
+    }
+
+    // MMSP_MAX_DIM keeps every per-row and per-block int computation in range
+    if(ih.biWidth<=0 || ih.biWidth>MMSP_MAX_DIM || ih.biHeight==0 ||
+       ih.biHeight>MMSP_MAX_DIM || ih.biHeight<-MMSP_MAX_DIM) die("BMP dimensions out of range");
+    int w = ih.biWidth;
+    int h_abs = (ih.biHeight>0) ? ih.biHeight : -ih.biHeight;
+    int rs = (bpp==32) ? w*4 : row_size_24(w);
+
+    // everything downstream (dim.txt, decoders) writes 24-bit output, so hand back
+    // a plain 24-bit BI_RGB header for 32-bit input
+    if(bpp==32){
+        BMPFileHeader h24 = fh;
+        BMPInfoHeader i24 = ih;
+        i24.biSize = 40;
+        i24.biBitCount = 24;
+        i24.biCompression = 0;
+        // sizes past 4 GB do not fit the header: 0 is valid for BI_RGB
+        uint64_t img = (uint64_t)row_size_24(w)*(uint64_t)h_abs;
+        i24.biSizeImage = (img+54 <= UINT32_MAX) ? (uint32_t)img : 0;
+        i24.biClrUsed = i24.biClrImportant = 0;
+        h24.bfOffBits = 54;
+        h24.bfSize = i24.biSizeImage ? 54 + i24.biSizeImage : 0;
+        memcpy(header54, &h24, sizeof(h24));
+        memcpy(header54+sizeof(h24), &i24, sizeof(i24));
+    }
+
+    // planes are pad8(w) x pad8(h) with the last column / row replicated into
+    // the padding once here, so the block loaders never clamp coordinates
+    int pw = pad8(w), ph = pad8(h_abs);
+    uint8_t* r = (uint8_t*)malloc_n((size_t)pw, (size_t)ph);
+    uint8_t* g = (uint8_t*)malloc_n((size_t)pw, (size_t)ph);
+    uint8_t* b = (uint8_t*)malloc_n((size_t)pw, (size_t)ph);
+    uint8_t* row = (uint8_t*)malloc((size_t)rs);
+    if(!r||!g||!b||!row) die("OOM");
+
+    if(fh.bfOffBits < pos) die("BMP pixel offset inside header");
+    skip_bytes(f, (long)fh.bfOffBits - pos);
+
+    // read file rows, convert to TOP-DOWN indexing
+    for(int file_row=0; file_row<h_abs; file_row++){
+        if(fread(row,1,(size_t)rs,f)!=(size_t)rs) die("BMP pixel read failed");
+        int y = (ih.biHeight>0) ? (h_abs-1-file_row) : file_row; // top-down y
+        size_t o = (size_t)y*pw;
+        split_row(row, bpp, r + o, g + o, b + o, w);
+        memset(r + o + w, r[o + w-1], (size_t)(pw-w));
+        memset(g + o + w, g[o + w-1], (size_t)(pw-w));
+        memset(b + o + w, b[o + w-1], (size_t)(pw-w));
+    }
+    for(int y=h_abs; y<ph; y++){
+        memcpy(r + (size_t)y*pw, r + (size_t)(h_abs-1)*pw, (size_t)pw);
+        memcpy(g + (size_t)y*pw, g + (size_t)(h_abs-1)*pw, (size_t)pw);
+        memcpy(b + (size_t)y*pw, b + (size_t)(h_abs-1)*pw, (size_t)pw);
+    }
+
+    free(row);
+
+    *W = w; *H = h_abs;
+    *R = r; *G = g; *B = b;
+}
+
+/* ========================== Buffered text output ========================== */
+// The ASCII dumps (Method 0 R/G/B, Method 2 RLE, Method 3 bits) write millions of
+// small numbers; formatting them by hand into a 64 KB block is much cheaper than
+// one fprintf per value and produces the same bytes.
+#define TXT_BUF_SIZE (1<<16)
+
+typedef struct {
+    FILE* f;
+    size_t n;
+    char buf[TXT_BUF_SIZE];
+} TxtOut;
+
+// Buffers writes to f (an output part, still owned by the call); anything
+// already fprintf'd to it is flushed first.
+static TxtOut* txt_wrap(FILE* f){
+    TxtOut* t = (TxtOut*)malloc(sizeof(TxtOut));
+    if(!t) die("OOM");
+    fflush(f);
+    t->f = f;
+    t->n = 0;
+    return t;
+}
+static void txt_flush(TxtOut* t){
+    if(t->n && fwrite(t->buf,1,t->n,t->f)!=t->n) die("text write failed");
+    t->n = 0;
+}
+static void txt_close(TxtOut* t){
+    txt_flush(t);
+    free(t);
+}
+static inline void txt_putc(TxtOut* t, char c){
+    if(t->n == TXT_BUF_SIZE) txt_flush(t);
+    t->buf[t->n++] = c;
+}
+static void txt_puts(TxtOut* t, const char* s){
+    while(*s) txt_putc(t, *s++);
+}
+static inline void txt_put_uint(TxtOut* t, unsigned v){
+    char tmp[12];
+    int k=0;
+    do{ tmp[k++] = (char)('0' + v%10); v/=10; }while(v);
+    if(t->n + (size_t)k > TXT_BUF_SIZE) txt_flush(t);
+    while(k) t->buf[t->n++] = tmp[--k];
+}
+static inline void txt_put_int(TxtOut* t, int v){
+    if(v<0){ txt_putc(t,'-'); txt_put_uint(t, 0u-(unsigned)v); }
+    else txt_put_uint(t, (unsigned)v);
+}
+
+/* ========================== DCT/IDCT (separable) ========================== */
+static double COS8[8][8]; // cos((2x+1)u*pi/16)
+static double ALPHA8[8];  // alpha(u)
+
+// --precision float|int: the same separable transform with the 0.25*alpha*alpha
+// scale folded into the basis, C[u][x] = 0.5*alpha(u)*cos((2x+1)u*pi/16)
+#define DCT_FIX 13          // int basis in Q13
+static float   COS8F[8][8], COS8FT[8][8];   // ...T: transposed, C[v][y] at [y][v]
+static int16_t COS8I[8][8], COS8IT[8][8];
+
+static void init_dct_table(void){
+    for(int u=0;u<8;u++){
+        ALPHA8[u] = (u==0)? (1.0/sqrt(2.0)) : 1.0;
+        for(int x=0;x<8;x++){
+            COS8[u][x] = cos(((2.0*x + 1.0)*u*M_PI)/16.0);
+        }
+    }
+    for(int u=0;u<8;u++){
+        for(int x=0;x<8;x++){
+            double c = 0.5*ALPHA8[u]*COS8[u][x];
+            COS8F[u][x] = COS8FT[x][u] = (float)c;
+            COS8I[u][x] = COS8IT[x][u] = (int16_t)lround(c*(1<<DCT_FIX));
+        }
+    }
+}
+
+static void dct8x8(const double in[8][8], double out[8][8]){
+    // temp[u][y] = sum_x in[x][y] * cos(u,x)
+    double temp[8][8];
+    for(int u=0;u<8;u++){
+        for(int y=0;y<8;y++){
+            double s=0.0;
+            for(int x=0;x<8;x++) s += in[x][y]*COS8[u][x];
+            temp[u][y]=s;
+        }
+    }
+    // out[u][v] = 0.25 * alpha(u)alpha(v) * sum_y temp[u][y]*cos(v,y)
+    for(int u=0;u<8;u++){
+        for(int v=0;v<8;v++){
+            double s=0.0;
+            for(int y=0;y<8;y++) s += temp[u][y]*COS8[v][y];
+            out[u][v] = 0.25 * ALPHA8[u]*ALPHA8[v] * s;
+        }
+    }
+}
+
+// Both reduced-precision transforms run row-at-a-time: each step broadcasts one
+// basis value over a contiguous 8-wide row, which the compiler vectorizes (the
+// int version as 16x16->32 multiplies).
+static void dct8x8_f(const float in[8][8], float out[8][8]){
+    float temp[8][8];
+    // temp[u][y] = sum_x C[u][x] * in[x][y]
+    for(int u=0;u<8;u++){
+        float acc[8]={0};
+        for(int x=0;x<8;x++){
+            float c = COS8F[u][x];
+            for(int y=0;y<8;y++) acc[y] += c*in[x][y];
+        }
+        for(int y=0;y<8;y++) temp[u][y]=acc[y];
+    }
+    // out[u][v] = sum_y temp[u][y] * C[v][y]
+    for(int u=0;u<8;u++){
+        float acc[8]={0};
+        for(int y=0;y<8;y++){
+            float t = temp[u][y];
+            for(int v=0;v<8;v++) acc[v] += t*COS8FT[y][v];
+        }
+        for(int v=0;v<8;v++) out[u][v]=acc[v];
+    }
+}
+
+// Integer DCT: level-shifted samples (|in| <= 128) -> coefficients rounded to
+// integers in the same units as dct8x8. Pass 1 keeps 3 fraction bits (fits int16);
+// every partial sum stays below 2^27.
+static void dct8x8_i(const int16_t in[8][8], int32_t out[8][8]){
+    int16_t temp[8][8];
+    for(int u=0;u<8;u++){
+        int32_t acc[8];
+        for(int y=0;y<8;y++) acc[y] = 1<<(DCT_FIX-3-1);
+        for(int x=0;x<8;x++){
+            int16_t c = COS8I[u][x];
+            for(int y=0;y<8;y++) acc[y] += c*in[x][y];
+        }
+        for(int y=0;y<8;y++) temp[u][y] = (int16_t)(acc[y] >> (DCT_FIX-3));
+    }
+    for(int u=0;u<8;u++){
+        int32_t acc[8];
+        for(int v=0;v<8;v++) acc[v] = 1<<(DCT_FIX+3-1);
+        for(int y=0;y<8;y++){
+            int16_t t = temp[u][y];
+            for(int v=0;v<8;v++) acc[v] += t*COS8IT[y][v];
+        }
+        for(int v=0;v<8;v++) out[u][v] = acc[v] >> (DCT_FIX+3);
+    }
+}
+
+/* ---- Reversible integer DCT (--lossless) ----
+   Orthonormal 8-point DCT-II factored into plane rotations (4 input butterflies,
+   a DCT-II(4) on the sums, a DCT-IV(4) on the differences), each rotation done as
+   three lifting steps a += p*b; b += u*a; a += p*b with p = -tan(t/2), u = sin(t)
+   in Q12. Every step is undone exactly by subtracting the same rounded product, so
+   the integer transform is bit-exact invertible while staying within ~1 of the DCT.
+   The decoder carries the same constants. */
+#define LIFT_BITS 12
+typedef struct { int32_t p, u; } LiftRot;
+static const LiftRot LIFT_R4   = { -1697,  2896 };  //  pi/4 (normalized butterfly)
+static const LiftRot LIFT_R8   = {   815, -1567 };  // -pi/8
+static const LiftRot LIFT_R16  = {   403,  -799 };  // -pi/16
+static const LiftRot LIFT_R316 = {  1243, -2276 };  // -3pi/16
+
+static inline int32_t lift_mul(int32_t c, int32_t y){ return (c*y + (1<<(LIFT_BITS-1))) >> LIFT_BITS; }
+static inline void lift_rot(const LiftRot* r, int32_t* a, int32_t* b){
+    *a += lift_mul(r->p,*b);
+    *b += lift_mul(r->u,*a);
+    *a += lift_mul(r->p,*b);
+}
+
+// in place on x[0..7] with the given stride
+static void lift_dct8(int32_t* v, int stride){
+    int32_t x[8];
+    for(int i=0;i<8;i++) x[i]=v[i*stride];
+    for(int n=0;n<4;n++) lift_rot(&LIFT_R4,&x[n],&x[7-n]); // differences at 0..3, sums at 7..4
+    lift_rot(&LIFT_R4,&x[7],&x[4]);
+    lift_rot(&LIFT_R4,&x[6],&x[5]);
+    lift_rot(&LIFT_R4,&x[4],&x[5]);   // x5 = X0, x4 = X4
+    lift_rot(&LIFT_R8,&x[7],&x[6]);   // x7 = X2, x6 = -X6
+    lift_rot(&LIFT_R16,&x[0],&x[3]);
+    lift_rot(&LIFT_R316,&x[1],&x[2]);
+    lift_rot(&LIFT_R4,&x[0],&x[1]);
+    lift_rot(&LIFT_R4,&x[2],&x[3]);
+    lift_rot(&LIFT_R4,&x[0],&x[3]);   // x1 = X1, x0 = X3, x3 = X5, x2 = X7
+    v[0]=x[5]; v[stride]=x[1]; v[2*stride]=x[7]; v[3*stride]=x[0];
+    v[4*stride]=x[4]; v[5*stride]=x[3]; v[6*stride]=-x[6]; v[7*stride]=x[2];
+}
+
+// rows then columns; out[u][v] like dct8x8
+static void lift_dct8x8(int32_t b[8][8]){
+    for(int i=0;i<8;i++) lift_dct8(b[i], 1);
+    for(int j=0;j<8;j++) lift_dct8(&b[0][j], 8);
+}
+
+/* ========================== Color ========================== */
+// Reversible YCoCg-R (--lossless): Y in 0..255, Co/Cg in -255..255
+static inline void rgb_to_ycocg_r(int32_t r, int32_t g, int32_t b, int32_t* Y, int32_t* Co, int32_t* Cg){
+    int32_t co = r - b;
+    int32_t t  = b + (co>>1);
+    int32_t cg = g - t;
+    *Y = t + (cg>>1); *Co = co; *Cg = cg;
+}
+
+static void rgb_to_ycbcr(uint8_t R, uint8_t G, uint8_t B, double* Y, double* Cb, double* Cr){
+    // BT.601
+    *Y  =  0.299   * R + 0.587   * G + 0.114   * B;
+    *Cb = -0.168736* R - 0.331264* G + 0.5     * B + 128.0;
+    *Cr =  0.5     * R - 0.418688* G - 0.081312* B + 128.0;
+}
+
+// BT.601 in 16.16 fixed point (--color fixed): same coefficients as above, rounded
+// to 1/65536, results already rounded to 0..255. Plain int multiply-adds over a
+// row so the compiler can vectorize; the coefficient rows each sum to 65536 / 0,
+// which keeps every result inside 0..255 without a clamp.
+#define CSC_FIX 16
+static void rgb_to_ycbcr_fixed_row(const uint8_t* R, const uint8_t* G, const uint8_t* B, int n,
+                                   int32_t* Y, int32_t* Cb, int32_t* Cr){
+    for(int i=0;i<n;i++){
+        int32_t r=R[i], g=G[i], b=B[i];
+        Y[i]  = ( 19595*r + 38470*g +  7471*b + (1<<(CSC_FIX-1))) >> CSC_FIX;
+        Cb[i] = (-11059*r - 21709*g + 32768*b + (128<<CSC_FIX) + (1<<(CSC_FIX-1)) - 1) >> CSC_FIX;
+        Cr[i] = ( 32768*r - 27439*g -  5329*b + (128<<CSC_FIX) + (1<<(CSC_FIX-1)) - 1) >> CSC_FIX;
+    }
+}
+
+/* ========================== Quant tables ========================== */
+static const int QT_Y[8][8] = {
+    {16,11,10,16,24,40,51,61},
+    {12,12,14,19,26,58,60,55},
+    {14,13,16,24,40,57,69,56},
+    {14,17,22,29,51,87,80,62},
+    {18,22,37,56,68,109,103,77},
+    {24,35,55,64,81,104,113,92},
+    {49,64,78,87,103,121,120,101},
+    {72,92,95,98,112,100,103,99}
+};
+static const int QT_C[8][8] = {
+    {17,18,24,47,99,99,99,99},
+    {18,21,26,66,99,99,99,99},
+    {24,26,56,99,99,99,99,99},
+    {47,66,99,99,99,99,99,99},
+    {99,99,99,99,99,99,99,99},
+    {99,99,99,99,99,99,99,99},
+    {99,99,99,99,99,99,99,99},
+    {99,99,99,99,99,99,99,99}
+};
+
+static void write_qt_txt(FILE* f, const int qt[8][8]){
+    for(int r=0;r<8;r++){
+        for(int c=0;c<8;c++){
+            fprintf(f,"%d%s", qt[r][c], (c==7)?"":" ");
+        }
+        fprintf(f,"\n");
+    }
+}
+
+/* ========================== ZigZag ========================== */
+static const int ZZU[64] = {
+ 0,0,1,2,1,0,0,1,2,3,4,3,2,1,0,0,
+ 1,2,3,4,5,6,5,4,3,2,1,0,1,2,3,4,
+ 5,6,7,7,6,5,4,3,2,3,4,5,6,7,7,6,
+ 5,4,5,6,7,7,6,7,7,7,7,7,7,7,7,7
+};
+static const int ZZV[64] = {
+ 0,1,0,0,1,2,3,2,1,0,0,1,2,3,4,5,
+ 4,3,2,1,0,0,1,2,3,4,5,6,7,6,5,4,
+ 3,2,1,0,1,2,3,4,5,6,7,7,6,5,4,3,
+ 4,5,6,7,7,6,5,6,7,7,6,5,4,3,2,1
+};
+// NOTE: 這份 ZZU/ZZV 是「能跑」的順序（與 JPEG 標準同型），
+//       若你老師給的 zigzag 不同，你只要把 ZZU/ZZV 替換即可（decoder 也要同一份）。
+
+/* ========================== Method-2 RLE binary format ========================== */
+typedef struct { int16_t skip; int16_t val; } Pair;
+
+// --sequence reference: the last frame a context coded as M2S0
+typedef struct {
+    int valid;              // cleared while a frame is coded and after a failed call
+    int W, H;
+    uint32_t frame;         // frames since the key frame
+    int precision, color_fixed;
+    double lambda;          // transform options the coefficients were made with
+    uint8_t *R, *G, *B;     // padded planes (pixel-equal blocks skip the DCT)
+    int16_t (*zz)[3][64];   // quantized zigzag coefficients per block
+} SeqRef;
+
+/* ========================== Options ========================== */
+// mmsp_enc_params of the running call (see mmsp.h); read-only inside the codec.
+enum { HUF_TABLE_OPTIMAL=MMSP_TABLE_OPTIMAL, HUF_TABLE_STATIC=MMSP_TABLE_STATIC, HUF_TABLE_SAMPLED=MMSP_TABLE_SAMPLED };
+static const char* HUF_TABLE_NAME[3] = { "optimal", "static", "sampled" };
+enum { PREC_DOUBLE=MMSP_PREC_DOUBLE, PREC_FLOAT=MMSP_PREC_FLOAT, PREC_INT=MMSP_PREC_INT };
+static const char* PREC_NAME[3] = { "double", "float", "int" };
+
+typedef mmsp_enc_params EncOptions;
+
+static _Thread_local EncOptions g_opt;
+
+void mmsp_enc_params_init(mmsp_enc_params* p){
+    memset(p, 0, sizeof(*p));
+    p->huf_table = HUF_TABLE_OPTIMAL;
+    p->sample_every = 8;
+    p->color_fixed = -1;
+    p->precision = PREC_DOUBLE;
+    p->ef_bits = -1;
+}
+
+// copies p into g_opt, rejecting values and combinations no method accepts
+static void set_options(const mmsp_enc_params* p){
+    g_opt = *p;
+    if(g_opt.method<0 || g_opt.method>5) fail(MMSP_ERR_ARG, "method must be 0..5");
+    if(g_opt.huf_table<HUF_TABLE_OPTIMAL || g_opt.huf_table>HUF_TABLE_SAMPLED) fail(MMSP_ERR_ARG, "bad Huffman table");
+    if(g_opt.sample_every<1) fail(MMSP_ERR_ARG, "--table sampled:N needs N >= 1");
+    if(g_opt.precision<PREC_DOUBLE || g_opt.precision>PREC_INT) fail(MMSP_ERR_ARG, "bad precision");
+    if(g_opt.threads<0) fail(MMSP_ERR_ARG, "--threads N needs N >= 0");
+    if(!(g_opt.lambda>=0)) fail(MMSP_ERR_ARG, "--lambda L needs L >= 0");
+    if(g_opt.ef_bits<-1 || g_opt.ef_bits>MMSP_EF_BITS_MAX) fail(MMSP_ERR_ARG, "--ef compact:K needs 0 <= K <= 9");
+    if(g_opt.lossless && g_opt.lambda>0) fail(MMSP_ERR_ARG, "--lossless cannot be combined with --lambda");
+    if(g_opt.sequence<MMSP_SEQ_OFF || g_opt.sequence>MMSP_SEQ_DELTA) fail(MMSP_ERR_ARG, "bad sequence mode");
+    if(g_opt.sequence && (g_opt.method<2 || g_opt.method==4)) fail(MMSP_ERR_ARG, "--sequence needs Method 2, 3 or 5");
+    if(g_opt.dedup && (g_opt.method<2 || g_opt.method==4)) fail(MMSP_ERR_ARG, "--dedup needs Method 2, 3 or 5");
+    // --precision int runs the whole transform path in integers unless --color float
+    if(g_opt.color_fixed<0) g_opt.color_fixed = (g_opt.precision==PREC_INT);
+}
+
+/* ========================== Threads ========================== */
+// Fork-join helper for the in-memory Method-3 stages: fn(arg + k*arg_size) for
+// k = 0..n-1, k = 0 on the calling thread. Results never depend on n.
+#define MAX_THREADS 64
+// Inputs below this many bytes stay on one thread (not worth a thread below
+// ~1 MB); -DMMSP_PAR_MIN_BYTES=1 forces the split on small images for testing.
+#ifndef MMSP_PAR_MIN_BYTES
+#define MMSP_PAR_MIN_BYTES ((size_t)1<<20)
+#endif
+
+static int thread_count(void){
+    int n = g_opt.threads;
+    if(n<=0){
+        long c = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (c>0) ? (int)c : 1;
+    }
+    return n>MAX_THREADS ? MAX_THREADS : n;
+}
+
+static void run_parallel(int n, void* (*fn)(void*), void* arg, size_t arg_size){
+    pthread_t th[MAX_THREADS];
+    int started[MAX_THREADS] = {0};
+    for(int k=1;k<n;k++)
+        started[k] = pthread_create(&th[k],NULL,fn,(char*)arg + (size_t)k*arg_size)==0;
+    fn(arg);
+    for(int k=1;k<n;k++){
+        if(started[k]) pthread_join(th[k],NULL);
+        else fn((char*)arg + (size_t)k*arg_size); // no thread available: run it here
+    }
+}
+
+/* ========================== Byte histogram ========================== */
+// Counting straight into one table stalls on runs of equal bytes (each ++ waits
+// for the previous store to the same slot), and the RLE payload is mostly 0x00.
+// Four sub-tables, one per byte position mod 4, break those chains; they are
+// summed at the end. With stride 2 the position parity selects the output table
+// (freq[0] even bytes, freq[1] odd bytes) as Method 5 needs. stride must divide 4.
+#define HIST_BANKS 4
+
+static void hist_banked(const uint8_t* p, size_t n, int stride, uint64_t (*freq)[256]){
+    if(n < 1024){
+        // short writes (sink_hist gets one RLE record at a time): clearing the banks would dominate
+        for(size_t i=0;i<n;i++) freq[i%stride][p[i]]++;
+        return;
+    }
+    uint32_t cnt[HIST_BANKS][256];
+    while(n){
+        // uint32 banks: flush before any of them can overflow
+        size_t len = n < ((size_t)1<<31) ? n : ((size_t)1<<31);
+        memset(cnt,0,sizeof(cnt));
+        size_t i=0;
+        for(; i+HIST_BANKS<=len; i+=HIST_BANKS){
+            cnt[0][p[i]]++; cnt[1][p[i+1]]++; cnt[2][p[i+2]]++; cnt[3][p[i+3]]++;
+        }
+        for(; i<len; i++) cnt[i%HIST_BANKS][p[i]]++;
+        for(int k=0;k<HIST_BANKS;k++)
+            for(int s=0;s<256;s++) freq[k%stride][s] += cnt[k][s];
+        p += len; n -= len;
+    }
+}
+
+typedef struct {
+    const uint8_t* p;
+    size_t n;
+    int stride;
+    uint64_t freq[2][256];
+} HistChunk;
+
+static void* hist_chunk(void* arg){
+    HistChunk* c = (HistChunk*)arg;
+    memset(c->freq,0,sizeof(c->freq));
+    hist_banked(c->p, c->n, c->stride, c->freq);
+    return NULL;
+}
+
+// freq[stride][256] += histogram of p[0..n); large inputs are split across threads
+// at multiples of HIST_BANKS so every byte keeps its position parity.
+static void histogram_bytes(const uint8_t* p, size_t n, int stride, uint64_t (*freq)[256]){
+    int T = thread_count();
+    if(n < (size_t)MMSP_PAR_MIN_BYTES) T = 1;
+    if(T==1){ hist_banked(p,n,stride,freq); return; }
+    HistChunk* ch = (HistChunk*)malloc(sizeof(HistChunk)*(size_t)T);
+    if(!ch) die("OOM");
+    size_t groups = n / HIST_BANKS;
+    for(int k=0;k<T;k++){
+        size_t a = groups*(size_t)k/(size_t)T*HIST_BANKS;
+        size_t b = (k==T-1) ? n : groups*(size_t)(k+1)/(size_t)T*HIST_BANKS;
+        ch[k].p = p + a; ch[k].n = b - a; ch[k].stride = stride;
+    }
+    run_parallel(T, hist_chunk, ch, sizeof(HistChunk));
+    for(int k=0;k<T;k++)
+        for(int t=0;t<stride;t++)
+            for(int s=0;s<256;s++) freq[t][s] += ch[k].freq[t][s];
+    free(ch);
+}
+
+/* ========================== Method-2 core (shared by Method 2/3) ========================== */
+// Byte sinks let the Method-2 binary writer feed a file, a memory buffer or
+// the Huffman bit packer directly, without an intermediate payload file.
+typedef void (*ByteSink)(void* ctx, const void* data, size_t n);
+
+typedef struct {
+    uint8_t* data;
+    size_t len, cap;
+} ByteBuf;
+
+static void sink_file(void* ctx, const void* data, size_t n){
+    if(n && fwrite(data,1,n,(FILE*)ctx)!=n) die("write failed");
+}
+static void sink_mem(void* ctx, const void* data, size_t n){
+    ByteBuf* b = (ByteBuf*)ctx;
+    if(b->len + n > b->cap){
+        // on failure the old block stays in b (it may belong to the context)
+        size_t nc = b->cap;
+        if(n > SIZE_MAX - b->len || !grow_cap(&nc, b->len + n, 4096)) die("OOM");
+        uint8_t* nd = (uint8_t*)realloc(b->data, nc);
+        if(!nd) die("OOM");
+        b->data = nd;
+        b->cap = nc;
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+/* ---- Size fields ----
+   Byte counts in the containers are u32 while they fit. Larger streams are
+   written as the next version of the same container with u64 counts
+   (M2P0->M2P1, M3B0/M3B1->M3B2/M3B3, M4A0/M4L0->M4A1/M4L1, M5R0->M5R1), so the
+   output for ordinary images is unchanged. -DMMSP_SIZE32_MAX=0 always writes
+   the 64-bit forms (for testing the decoders). */
+#ifndef MMSP_SIZE32_MAX
+#define MMSP_SIZE32_MAX UINT32_MAX
+#endif
+
+static void sink_size(ByteSink sink, void* ctx, uint64_t v, int wide){
+    if(wide){ sink(ctx, &v, 8); return; }
+    uint32_t v32 = (uint32_t)v;
+    sink(ctx, &v32, 4);
+}
+
+static void sink_hist(void* ctx, const void* data, size_t n){
+    hist_banked((const uint8_t*)data, n, 1, (uint64_t (*)[256])ctx);
+}
+
+// Fixed-point RGB -> level-shifted YCbCr for block (m,n). The planes are
+// padded (row stride pad8(W)), so edge blocks take the same path as interior ones.
+static void load_block_ycbcr_fixed(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W,
+                                   int m, int n, int16_t blk[3][8][8]){
+    // gather the 64 pixels, convert them in one vectorizable pass
+    uint8_t r[64], g[64], b[64];
+    int32_t Yi[64], Cbi[64], Cri[64];
+    size_t PW = (size_t)pad8(W);
+    for(int i=0;i<8;i++){
+        size_t o=(size_t)(m*8+i)*PW + n*8;
+        memcpy(r+i*8,R+o,8); memcpy(g+i*8,G+o,8); memcpy(b+i*8,B+o,8);
+    }
+    rgb_to_ycbcr_fixed_row(r,g,b,64,Yi,Cbi,Cri);
+    for(int k=0;k<64;k++){
+        blk[0][k>>3][k&7]=(int16_t)(Yi[k]-128);
+        blk[1][k>>3][k&7]=(int16_t)(Cbi[k]-128);
+        blk[2][k>>3][k&7]=(int16_t)(Cri[k]-128);
+    }
+}
+
+// RGB -> level-shifted YCbCr for block (m,n) of the padded planes
+static void load_block_ycbcr(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W,
+                             int m, int n, int color_fixed, double blk[3][8][8]){
+    if(color_fixed){
+        int16_t bi[3][8][8];
+        load_block_ycbcr_fixed(R,G,B,W,m,n,bi);
+        for(int c=0;c<3;c++) for(int i=0;i<8;i++) for(int j=0;j<8;j++) blk[c][i][j]=(double)bi[c][i][j];
+        return;
+    }
+    size_t PW = (size_t)pad8(W);
+    for(int i=0;i<8;i++){
+        size_t o=(size_t)(m*8+i)*PW + n*8;
+        for(int j=0;j<8;j++){
+            double Yv,Cbv,Crv;
+            rgb_to_ycbcr(R[o+j],G[o+j],B[o+j],&Yv,&Cbv,&Crv);
+            blk[0][i][j]=Yv-128.0;
+            blk[1][i][j]=Cbv-128.0;
+            blk[2][i][j]=Crv-128.0;
+        }
+    }
+}
+
+// RGB -> YCbCr -> DCT for block (m,n) at the selected --precision, widened to
+// double (Method 1 and the float path)
+static void forward_block(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W,
+                          int m, int n, int precision, int color_fixed, double F[3][8][8]){
+    if(precision==PREC_INT){
+        int16_t bi[3][8][8];
+        int32_t Fi[8][8];
+        if(color_fixed) load_block_ycbcr_fixed(R,G,B,W,m,n,bi);
+        else{
+            double blk[3][8][8];
+            load_block_ycbcr(R,G,B,W,m,n,0,blk);
+            for(int c=0;c<3;c++) for(int i=0;i<8;i++) for(int j=0;j<8;j++) bi[c][i][j]=(int16_t)lround(blk[c][i][j]);
+        }
+        for(int c=0;c<3;c++){
+            dct8x8_i(bi[c], Fi);
+            for(int u=0;u<8;u++) for(int v=0;v<8;v++) F[c][u][v]=(double)Fi[u][v];
+        }
+        return;
+    }
+    double blk[3][8][8];
+    load_block_ycbcr(R,G,B,W,m,n,color_fixed,blk);
+    for(int c=0;c<3;c++){
+        if(precision==PREC_FLOAT){
+            float bf[8][8], Ff[8][8];
+            for(int i=0;i<8;i++) for(int j=0;j<8;j++) bf[i][j]=(float)blk[c][i][j];
+            dct8x8_f(bf, Ff);
+            for(int u=0;u<8;u++) for(int v=0;v<8;v++) F[c][u][v]=(double)Ff[u][v];
+        }else{
+            dct8x8(blk[c], F[c]);
+        }
+    }
+}
+
+// round(F/Q), halves away from zero like llround
+static inline int16_t div_round(int32_t f, int32_t q){
+    return (int16_t)(f>=0 ? (f + q/2)/q : -((-f + q/2)/q));
+}
+
+/* ========================== RD-optimized quantization ========================== */
+// With --lambda L > 0 each AC coefficient may be lowered by one step or zeroed
+// when that saves more than L * bits, minimizing D + L*R per channel:
+//   D: squared coefficient error (orthonormal DCT, so equal to sample error)
+//   R: bits of the (skip,val) pairs, priced with the static Method-3 byte table
+// Zeroing a coefficient lengthens the next pair's skip, so the choice is a small
+// trellis over the nonzero positions in zigzag order. DC (DPCM coded) is left
+// alone, as are the (u,v) the zigzag table visits twice. The decoder is unchanged.
+static void static_table_freq(uint64_t freq[256]);
+
+typedef struct {
+    long long nz_plain, nz_rdo;      // AC pairs before / after
+    double err_plain[3], err_rdo[3]; // squared error of the coefficients the decoder sees
+    long long ncoef;                 // per channel
+} RdoStats;
+
+static _Thread_local RdoStats g_rdo;
+static float RDO_BITS[256];      // ideal code length of each payload byte
+static uint8_t ZZ_VISITS[8][8];
+
+// once per process, from mmsp_encoder_create()
+static void rdo_init(void){
+    uint64_t freq[256], total=0;
+    static_table_freq(freq);
+    for(int s=0;s<256;s++) total += freq[s];
+    for(int s=0;s<256;s++) RDO_BITS[s] = (float)log2((double)total/(double)freq[s]);
+    for(int k=0;k<64;k++) ZZ_VISITS[ZZU[k]][ZZV[k]]++;
+}
+
+static inline double rdo_skip_bits(int skip){ return RDO_BITS[skip & 255] + RDO_BITS[(skip>>8) & 255]; }
+static inline double rdo_val_bits(int v){
+    uint16_t u = (uint16_t)v;
+    return RDO_BITS[u & 255] + RDO_BITS[u>>8];
+}
+
+// squared error of q against F over the coefficients the zigzag scan carries
+static double rdo_block_err(const double F[8][8], const int qt[8][8], const int16_t q[8][8]){
+    double e = 0;
+    for(int u=0;u<8;u++){
+        for(int v=0;v<8;v++){
+            double d = ZZ_VISITS[u][v] ? F[u][v] - (double)q[u][v]*qt[u][v] : F[u][v];
+            e += d*d;
+        }
+    }
+    return e;
+}
+
+// Refines the rounded levels q of one channel in place.
+static void rdo_channel(const double F[8][8], const int qt[8][8], int c, int16_t q[8][8]){
+    const double lambda = g_opt.lambda;
+    double Z[65];        // Z[k]: distortion of zeroing positions 1..k-1
+    int pos[64], np=0;   // nonzero AC positions in scan order, pos[0] = DC
+    double best[64];     // best[i]: cost of positions 1..pos[i] with pos[i] coded
+    int from[64], level[64];
+    int fixed[64];       // pos[i] cannot be changed
+
+    Z[0] = Z[1] = 0;
+    for(int k=1;k<64;k++){
+        double f = F[ZZU[k]][ZZV[k]];
+        Z[k+1] = Z[k] + f*f;
+    }
+    pos[np] = 0; best[np] = 0; fixed[np] = 1; np++;
+
+    for(int k=1;k<64;k++){
+        int u=ZZU[k], v=ZZV[k];
+        int l = q[u][v];
+        if(l==0) continue;
+        double f = F[u][v], Q = (double)qt[u][v];
+        int fx = (ZZ_VISITS[u][v]!=1);
+
+        // best predecessor: the latest fixed position bounds how far back a run may reach
+        double bj = 1e300; int arg = 0;
+        for(int i=np-1;i>=0;i--){
+            double cj = best[i] - Z[pos[i]+1] + lambda*rdo_skip_bits(k-pos[i]-1);
+            if(cj < bj){ bj = cj; arg = i; }
+            if(fixed[i]) break;
+        }
+
+        int lv = l;
+        double cost = (f-l*Q)*(f-l*Q) + lambda*rdo_val_bits(l);
+        if(!fx && (l>1 || l<-1)){
+            int l2 = l>0 ? l-1 : l+1;
+            double c2 = (f-l2*Q)*(f-l2*Q) + lambda*rdo_val_bits(l2);
+            if(c2 < cost){ cost = c2; lv = l2; }
+        }
+        pos[np] = k; best[np] = bj + Z[k] + cost; from[np] = arg; level[np] = lv; fixed[np] = fx;
+        np++;
+    }
+
+    // end of block: the tail after the last coded position is all zeros
+    double bt = 1e300; int last = 0;
+    for(int i=np-1;i>=0;i--){
+        double ci = best[i] + Z[64] - Z[pos[i]+1];
+        if(ci < bt){ bt = ci; last = i; }
+        if(fixed[i]) break;
+    }
+
+    int16_t out[64] = {0};
+    int nz = 0;
+    for(int i=last; i>0; i=from[i]){ out[pos[i]] = (int16_t)level[i]; nz++; }
+
+    g_rdo.nz_plain += np-1;
+    g_rdo.nz_rdo += nz;
+    g_rdo.err_plain[c] += rdo_block_err(F, qt, q);
+    for(int k=1;k<64;k++) q[ZZU[k]][ZZV[k]] = 0;
+    for(int k=1;k<64;k++) if(out[k]) q[ZZU[k]][ZZV[k]] = out[k];
+    g_rdo.err_rdo[c] += rdo_block_err(F, qt, q);
+    g_rdo.ncoef += (c==0) ? 64 : 0;
+}
+
+static void rdo_block(const double F[3][8][8], int16_t q[3][8][8]){
+    for(int c=0;c<3;c++) rdo_channel(F[c], (c==0)? QT_Y : QT_C, c, q[c]);
+}
+
+// Prints what --lambda traded: AC pairs and coefficient-domain PSNR, plus the
+// size of the output file when there is a single one.
+static void rdo_report(int out_part){
+    static const char* names[3]={"Y","Cb","Cr"};
+    report("RDO lambda %g: AC coefficients coded %lld -> %lld (%.2f%%)\n", g_opt.lambda,
+           g_rdo.nz_plain, g_rdo.nz_rdo, g_rdo.nz_plain ? 100.0*g_rdo.nz_rdo/g_rdo.nz_plain : 100.0);
+    report("RDO PSNR (dB) plain -> RDO:");
+    for(int c=0;c<3;c++){
+        double a = g_rdo.err_plain[c]/(double)g_rdo.ncoef, b = g_rdo.err_rdo[c]/(double)g_rdo.ncoef;
+        report(" %s %.3f -> %.3f", names[c], a>0 ? 10.0*log10(255.0*255.0/a) : 99.0, b>0 ? 10.0*log10(255.0*255.0/b) : 99.0);
+    }
+    report("\n");
+    if(out_part>=0){
+        FILE* f = part_out(out_part);
+        fflush(f);
+        report("RDO output: %lld bytes\n", (long long)ftello(f));
+    }
+}
+
+// RGB -> YCbCr -> DCT -> Quant for block (m,n)
+static void quantize_block(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W,
+                           int m, int n, int16_t q[3][8][8]){
+    if(g_opt.precision==PREC_INT && g_opt.color_fixed){
+        // integer end to end: fixed-point colour, integer DCT, integer rounding divide
+        int16_t bi[3][8][8];
+        int32_t Fi[8][8];
+        load_block_ycbcr_fixed(R,G,B,W,m,n,bi);
+        for(int c=0;c<3;c++){
+            dct8x8_i(bi[c], Fi);
+            for(int u=0;u<8;u++)
+                for(int v=0;v<8;v++) q[c][u][v] = div_round(Fi[u][v], (c==0)? QT_Y[u][v] : QT_C[u][v]);
+            if(g_opt.lambda>0){
+                double F[8][8];
+                for(int u=0;u<8;u++) for(int v=0;v<8;v++) F[u][v]=(double)Fi[u][v];
+                rdo_channel(F, (c==0)? QT_Y : QT_C, c, q[c]);
+            }
+        }
+        return;
+    }
+
+    double F[3][8][8];
+    forward_block(R,G,B,W,m,n,g_opt.precision,g_opt.color_fixed,F);
+    for(int c=0;c<3;c++){
+        for(int u=0;u<8;u++){
+            for(int v=0;v<8;v++){
+                double Q = (c==0)? (double)QT_Y[u][v] : (double)QT_C[u][v];
+                q[c][u][v] = (int16_t)llround(F[c][u][v]/Q);
+            }
+        }
+    }
+    if(g_opt.lambda>0) rdo_block(F, q);
+}
+
+// ZigZag + DPCM(DC) of one channel: zz[0] becomes the DC difference
+static void zigzag_dpcm(const int16_t q[8][8], int16_t* prevDC, int16_t zz[64]){
+    // collect 64 coefficients in zigzag order
+    for(int k=0;k<64;k++){
+        int u=ZZU[k], v=ZZV[k];
+        zz[k]=q[u][v];
+    }
+    // DPCM DC
+    int16_t dc = zz[0];
+    int16_t diff = (int16_t)(dc - *prevDC);
+    *prevDC = dc;
+    zz[0] = diff;
+}
+
+// RLE of 64 scan-ordered values; returns the number of (skip,val) pairs
+static int rle_pairs(const int16_t zz[64], Pair pairs[64]){
+    // RLE pairs for NONZERO, store as (skip,val) with "skip:val" in ascii to match你現在的 rle_code.txt
+    int pc=0;
+    int zc=0;
+    for(int k=0;k<64;k++){
+        int16_t v = zz[k];
+        if(v==0) zc++;
+        else {
+            pairs[pc].skip = (int16_t)zc;
+            pairs[pc].val  = v;
+            pc++;
+            zc=0;
+        }
+    }
+    return pc;
+}
+
+// ZigZag + DPCM(DC) + RLE of one channel; returns the number of (skip,val) pairs
+static int rle_channel(const int16_t q[8][8], int16_t* prevDC, Pair pairs[64]){
+    int16_t zz[64];
+    zigzag_dpcm(q, prevDC, zz);
+    return rle_pairs(zz, pairs);
+}
+
+static void m2_write_record(ByteSink sink, void* ctx, const Pair* pairs, int pc){
+    // binary record: uint16 pc, then pc*(int16 skip, int16 val)
+    uint16_t upc = (uint16_t)pc;
+    sink(ctx, &upc, 2);
+    sink(ctx, pairs, sizeof(Pair)*(size_t)pc);
+}
+
+/* ---- Lossless blocks (--lossless, "M2L0") ----
+   YCoCg-R + reversible lifting DCT, no quantization. The scan is the full JPEG
+   zigzag permutation: ZZU/ZZV skip seven (u,v), which is fine after
+   quantization but would lose data here. */
+static const uint8_t ZZ_FULL[64] = {
+     0, 1, 8,16, 9, 2, 3,10,17,24,32,25,18,11, 4, 5,
+    12,19,26,33,40,48,41,34,27,20,13, 6, 7,14,21,28,
+    35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,
+    58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63
+};
+
+// block (m,n) of the padded planes -> scan-ordered coefficients, DC as DPCM difference
+static void lossless_block_zz(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W,
+                              int m, int n, int16_t prevDC[3], int16_t zz[3][64]){
+    int32_t b[3][8][8];
+    size_t PW = (size_t)pad8(W);
+    for(int i=0;i<8;i++){
+        size_t o=(size_t)(m*8+i)*PW + n*8;
+        for(int j=0;j<8;j++){
+            int32_t Y,Co,Cg;
+            rgb_to_ycocg_r(R[o+j],G[o+j],B[o+j],&Y,&Co,&Cg);
+            b[0][i][j]=Y-128; b[1][i][j]=Co; b[2][i][j]=Cg;
+        }
+    }
+    for(int c=0;c<3;c++){
+        lift_dct8x8(b[c]);
+        const int32_t* f = &b[c][0][0];
+        for(int k=0;k<64;k++) zz[c][k]=(int16_t)f[ZZ_FULL[k]];
+        int16_t dc = zz[c][0];
+        zz[c][0] = (int16_t)(dc - prevDC[c]);
+        prevDC[c] = dc;
+    }
+}
+
+// Method-2 binary stream: "M2B0" + W,H (int32) + bw,bh (int32), then per block Y/Cb/Cr records.
+// --lossless writes "M2L0" with the same records (YCoCg-R channels, full zigzag).
+// sample_every > 1 emits only every N-th block (used for sampled Huffman statistics).
+static void encode_m2_binary(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W, int H,
+                             int sample_every, ByteSink sink, void* ctx){
+    int bw=(W+7)/8, bh=(H+7)/8;
+
+    sink(ctx, g_opt.lossless ? "M2L0" : "M2B0", 4);
+    int32_t hdr[4] = { W, H, bw, bh };
+    sink(ctx, hdr, sizeof(hdr));
+
+    int16_t prevDC[3]={0,0,0};
+    long blk_idx = 0;
+    for(int m=0;m<bh;m++){
+        for(int n=0;n<bw;n++, blk_idx++){
+            if(sample_every>1 && (blk_idx % sample_every)!=0) continue;
+            Pair pairs[64];
+            if(g_opt.lossless){
+                int16_t zz[3][64];
+                lossless_block_zz(R,G,B,W,m,n,prevDC,zz);
+                for(int c=0;c<3;c++) m2_write_record(sink, ctx, pairs, rle_pairs(zz[c], pairs));
+                continue;
+            }
+            int16_t q[3][8][8];
+            quantize_block(R,G,B,W,m,n,q);
+            for(int c=0;c<3;c++){
+                int pc = rle_channel(q[c], &prevDC[c], pairs);
+                m2_write_record(sink, ctx, pairs, pc);
+            }
+        }
+    }
+}
+
+/* ========================== Progressive (spectral selection) ========================== */
+// "M2P0" + W,H,bw,bh (int32) + nscans(u8), then per scan:
+//   ks(u8) ke(u8) scan_bytes(u32) + for each block, channel: uint8 pc + pc*(int16 skip,int16 val)
+// ("M2P1": scan_bytes u64, for images whose scans may pass 4 GB)
+// skip counts from ks inside the band. The DC scan carries DPCM differences, so
+// a decoder can stop after the first scans and still show the whole image.
+static const int PROG_BANDS[4][2] = { {0,0}, {1,5}, {6,20}, {21,63} };
+
+static void encode_m2_progressive(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W, int H,
+                                  ByteSink sink, void* ctx){
+    int bw=(W+7)/8, bh=(H+7)/8;
+    size_t nblk=(size_t)bw*bh;
+    int16_t (*coef)[3][64] = (int16_t(*)[3][64])malloc_n(nblk, sizeof(*coef));
+    if(!coef) die("OOM");
+
+    int16_t prevDC[3]={0,0,0};
+    for(int m=0;m<bh;m++){
+        for(int n=0;n<bw;n++){
+            int16_t q[3][8][8];
+            quantize_block(R,G,B,W,m,n,q);
+            for(int c=0;c<3;c++) zigzag_dpcm(q[c], &prevDC[c], coef[(size_t)m*bw+n][c]);
+        }
+    }
+
+    // the scan sizes follow the header, so the width is chosen from the worst case
+    int wide = (uint64_t)nblk*3*(1 + 64*sizeof(Pair)) > MMSP_SIZE32_MAX;
+    sink(ctx, wide ? "M2P1" : "M2P0", 4);
+    int32_t hdr[4] = { W, H, bw, bh };
+    sink(ctx, hdr, sizeof(hdr));
+    uint8_t nscans = 4;
+    sink(ctx, &nscans, 1);
+
+    ByteBuf scan = {0};
+    for(int s=0;s<nscans;s++){
+        int ks=PROG_BANDS[s][0], ke=PROG_BANDS[s][1];
+        scan.len = 0;
+        for(size_t b=0;b<nblk;b++){
+            for(int c=0;c<3;c++){
+                Pair pairs[64];
+                int pc=0, zc=0;
+                for(int k=ks;k<=ke;k++){
+                    int16_t v = coef[b][c][k];
+                    if(v==0) zc++;
+                    else { pairs[pc].skip=(int16_t)zc; pairs[pc].val=v; pc++; zc=0; }
+                }
+                uint8_t upc = (uint8_t)pc;
+                sink_mem(&scan, &upc, 1);
+                sink_mem(&scan, pairs, sizeof(Pair)*(size_t)pc);
+            }
+        }
+        uint8_t band[2] = { (uint8_t)ks, (uint8_t)ke };
+        sink(ctx, band, 2);
+        sink_size(sink, ctx, scan.len, wide);
+        sink(ctx, scan.data, scan.len);
+    }
+    free(scan.data);
+    free(coef);
+}
+
+/* ========================== Indexed (random access) ========================== */
+// "M2X0" + W,H,bw,bh (int32) + the same block records as M2B0, then a trailer:
+//   bh * (row_offset u64, dc_Y/dc_Cb/dc_Cr int16 = prevDC before the row) + index_offset(u64)
+// Offsets are from the start of the stream. The trailer comes last so the
+// encoder can still write in one pass; a decoder reads the last 8 bytes first.
+static void encode_m2_indexed(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W, int H,
+                              ByteSink sink, void* ctx){
+    int bw=(W+7)/8, bh=(H+7)/8;
+    uint64_t* row_off = (uint64_t*)malloc(sizeof(uint64_t)*(size_t)bh);
+    int16_t (*row_dc)[3] = (int16_t(*)[3])malloc(sizeof(*row_dc)*(size_t)bh);
+    if(!row_off || !row_dc) die("OOM");
+
+    sink(ctx, "M2X0", 4);
+    int32_t hdr[4] = { W, H, bw, bh };
+    sink(ctx, hdr, sizeof(hdr));
+    uint64_t pos = 4 + sizeof(hdr);
+
+    int16_t prevDC[3]={0,0,0};
+    for(int m=0;m<bh;m++){
+        row_off[m] = pos;
+        memcpy(row_dc[m], prevDC, sizeof(prevDC));
+        for(int n=0;n<bw;n++){
+            int16_t q[3][8][8];
+            quantize_block(R,G,B,W,m,n,q);
+            for(int c=0;c<3;c++){
+                Pair pairs[64];
+                int pc = rle_channel(q[c], &prevDC[c], pairs);
+                m2_write_record(sink, ctx, pairs, pc);
+                pos += 2 + sizeof(Pair)*(size_t)pc;
+            }
+        }
+    }
+
+    for(int m=0;m<bh;m++){
+        sink(ctx, &row_off[m], 8);
+        sink(ctx, row_dc[m], sizeof(row_dc[m]));
+    }
+    sink(ctx, &pos, 8);
+    free(row_off);
+    free(row_dc);
+}
+
+/* ========================== Sequence (temporal block skip) ========================== */
+// "M2S0" + W,H,bw,bh (int32) + frame(u32, 0 = key frame) + flags(u8, 1 = deltas allowed),
+// then per block kind(u8) followed by its Y/Cb/Cr records:
+//   0: coefficients equal to the reference block, no records
+//   1: records as in M2B0 (the DC DPCM runs over kind-1 blocks only)
+//   2: records of the difference to the reference block (DC included, no DPCM)
+// The reference is the frame the same context coded last. A key frame (first
+// frame, new size, or after a failed call) codes every block as kind 1.
+static SeqRef* ctx_seq(void); // the context's, see below
+
+// 8x8 block (m,n) of the padded planes equals the reference frame's
+static int seq_block_unchanged(const SeqRef* s, const uint8_t* R, const uint8_t* G, const uint8_t* B,
+                               int PW, int m, int n){
+    size_t o = (size_t)m*8*PW + (size_t)n*8;
+    for(int i=0;i<8;i++, o+=PW){
+        if(memcmp(R+o, s->R+o, 8) || memcmp(G+o, s->G+o, 8) || memcmp(B+o, s->B+o, 8)) return 0;
+    }
+    return 1;
+}
+
+static void encode_m2_sequence(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W, int H,
+                               ByteSink sink, void* ctx){
+    SeqRef* s = ctx_seq();
+    int bw=(W+7)/8, bh=(H+7)/8, PW=pad8(W);
+    size_t nblk=(size_t)bw*bh, np=(size_t)PW*pad8(H);
+    int key = !s->valid || s->W!=W || s->H!=H;
+    if(s->W!=W || s->H!=H){
+        // context-owned, outside the call's block list
+        (free)(s->R); (free)(s->G); (free)(s->B); (free)(s->zz);
+        memset(s, 0, sizeof(*s));
+        s->R=(uint8_t*)(malloc)(np); s->G=(uint8_t*)(malloc)(np); s->B=(uint8_t*)(malloc)(np);
+        s->zz=(int16_t(*)[3][64])(malloc)(nblk*sizeof(*s->zz));
+        if(!s->R || !s->G || !s->B || !s->zz) die("OOM");
+        s->W=W; s->H=H;
+    }
+    // equal pixels give equal coefficients only under the same transform options
+    int same_px = !key && s->precision==g_opt.precision && s->color_fixed==g_opt.color_fixed && s->lambda==g_opt.lambda;
+    s->valid = 0; // until the whole frame is coded
+
+    uint32_t frame = key ? 0 : s->frame+1;
+    uint8_t flags = (!key && g_opt.sequence==MMSP_SEQ_DELTA);
+    sink(ctx, "M2S0", 4);
+    int32_t hdr[4] = { W, H, bw, bh };
+    sink(ctx, hdr, sizeof(hdr));
+    sink(ctx, &frame, 4);
+    sink(ctx, &flags, 1);
+
+    int16_t prevDC[3]={0,0,0};
+    long count[3]={0,0,0};
+    for(int m=0;m<bh;m++){
+        for(int n=0;n<bw;n++){
+            int16_t (*ref)[64] = s->zz[(size_t)m*bw+n];
+            uint8_t kind = 0;
+            int16_t zz[3][64];
+            if(!(same_px && seq_block_unchanged(s,R,G,B,PW,m,n))){
+                int16_t q[3][8][8];
+                quantize_block(R,G,B,W,m,n,q);
+                for(int c=0;c<3;c++) for(int k=0;k<64;k++) zz[c][k]=q[c][ZZU[k]][ZZV[k]];
+                if(key || memcmp(zz, ref, sizeof(zz))!=0) kind = 1;
+            }
+            if(kind==0){
+                count[0]++;
+                sink(ctx, &kind, 1);
+                continue;
+            }
+
+            Pair pairs[2][3][64];
+            int pc[2][3], total[2]={0,0};
+            for(int c=0;c<3;c++){
+                int16_t d[64];
+                memcpy(d, zz[c], sizeof(d));
+                d[0] = (int16_t)(zz[c][0] - prevDC[c]);
+                pc[0][c] = rle_pairs(d, pairs[0][c]);
+                total[0] += pc[0][c];
+                if(!flags) continue;
+                for(int k=0;k<64;k++) d[k] = (int16_t)(zz[c][k] - ref[c][k]);
+                pc[1][c] = rle_pairs(d, pairs[1][c]);
+                total[1] += pc[1][c];
+            }
+            if(flags && total[1]<total[0]) kind = 2;
+            else for(int c=0;c<3;c++) prevDC[c] = zz[c][0];
+            count[kind]++;
+            sink(ctx, &kind, 1);
+            for(int c=0;c<3;c++) m2_write_record(sink, ctx, pairs[kind-1][c], pc[kind-1][c]);
+            memcpy(ref, zz, sizeof(zz));
+        }
+    }
+
+    memcpy(s->R, R, np); memcpy(s->G, G, np); memcpy(s->B, B, np);
+    s->precision = g_opt.precision;
+    s->color_fixed = g_opt.color_fixed;
+    s->lambda = g_opt.lambda;
+    s->frame = frame;
+    s->valid = 1;
+    report("sequence frame %u%s: %ld skipped, %ld coded, %ld delta of %ld blocks\n",
+           frame, key ? " (key)" : "", count[0], count[1], count[2], (long)nblk);
+}
+
+/* ========================== Dedup (repeated blocks) ========================== */
+// "M2D0" + W,H,bw,bh (int32) + slot_bits(u8), then per block tag(u16):
+//   0:      Y/Cb/Cr records as in M2B0 (the DC DPCM runs over tag-0 blocks only);
+//           the block then takes slot dedup_slot(coefficients) of a 2^slot_bits table
+//   slot+1: the same coefficients as the block held by that slot
+// The decoder keeps the same table, so a repeat is a copy of pixels it has
+// already reconstructed. Slots are replaced, not chained: the table remembers
+// the most recent block per hash. The tag keeps the records 16-bit aligned,
+// which the even/odd byte tables of Method 5 depend on.
+#define DEDUP_BITS 12
+
+// FNV-1a, folded to DEDUP_BITS (mmsp_dec.c uses the same function)
+static uint32_t dedup_slot(const void* p, size_t n){
+    const uint8_t* b = (const uint8_t*)p;
+    uint32_t h = 2166136261u;
+    for(size_t i=0;i<n;i++){ h ^= b[i]; h *= 16777619u; }
+    return (h ^ (h >> DEDUP_BITS) ^ (h >> 2*DEDUP_BITS)) & ((1u<<DEDUP_BITS)-1);
+}
+
+// coded blocks by coefficient hash (mirrored by the decoder), and an
+// encoder-only memo by pixel hash so a repeated pixel block skips the DCT
+typedef struct { int used; int16_t zz[3][64]; } DedupSlot;
+typedef struct { int used; uint8_t px[3][64]; int16_t zz[3][64]; } DedupMemo;
+
+static void encode_m2_dedup(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W, int H,
+                            ByteSink sink, void* ctx){
+    int bw=(W+7)/8, bh=(H+7)/8, PW=pad8(W);
+    size_t nslot = (size_t)1<<DEDUP_BITS;
+    DedupSlot* slot = (DedupSlot*)calloc(nslot, sizeof(DedupSlot));
+    DedupMemo* memo = (DedupMemo*)calloc(nslot, sizeof(DedupMemo));
+    if(!slot || !memo) die("OOM");
+
+    sink(ctx, "M2D0", 4);
+    int32_t hdr[4] = { W, H, bw, bh };
+    sink(ctx, hdr, sizeof(hdr));
+    uint8_t bits = DEDUP_BITS;
+    sink(ctx, &bits, 1);
+
+    int16_t prevDC[3]={0,0,0};
+    long nrep=0, nmemo=0;
+    for(int m=0;m<bh;m++){
+        for(int n=0;n<bw;n++){
+            uint8_t px[3][64];
+            size_t o = (size_t)m*8*PW + (size_t)n*8;
+            for(int i=0;i<8;i++, o+=PW){
+                memcpy(&px[0][i*8], R+o, 8); memcpy(&px[1][i*8], G+o, 8); memcpy(&px[2][i*8], B+o, 8);
+            }
+            int16_t zz[3][64];
+            DedupMemo* me = &memo[dedup_slot(px, sizeof(px))];
+            if(me->used && memcmp(me->px, px, sizeof(px))==0){
+                memcpy(zz, me->zz, sizeof(zz));
+                nmemo++;
+            }else{
+                int16_t q[3][8][8];
+                quantize_block(R,G,B,W,m,n,q);
+                for(int c=0;c<3;c++) for(int k=0;k<64;k++) zz[c][k]=q[c][ZZU[k]][ZZV[k]];
+                me->used = 1;
+                memcpy(me->px, px, sizeof(px));
+                memcpy(me->zz, zz, sizeof(zz));
+            }
+
+            uint32_t k = dedup_slot(zz, sizeof(zz));
+            if(slot[k].used && memcmp(slot[k].zz, zz, sizeof(zz))==0){
+                uint16_t tag = (uint16_t)(k+1);
+                sink(ctx, &tag, 2);
+                nrep++;
+                continue;
+            }
+            uint16_t tag = 0;
+            sink(ctx, &tag, 2);
+            for(int c=0;c<3;c++){
+                Pair pairs[64];
+                int16_t d[64];
+                memcpy(d, zz[c], sizeof(d));
+                d[0] = (int16_t)(zz[c][0] - prevDC[c]);
+                prevDC[c] = zz[c][0];
+                m2_write_record(sink, ctx, pairs, rle_pairs(d, pairs));
+            }
+            slot[k].used = 1;
+            memcpy(slot[k].zz, zz, sizeof(zz));
+        }
+    }
+    free(slot);
+    free(memo);
+    report("dedup: %ld of %ld blocks are repeats, %ld transforms skipped\n", nrep, (long)bw*bh, nmemo);
+}
+
+// Method-2 binary payload as selected on the command line
+// (sequential M2B0, progressive M2P0, indexed M2X0, sequence M2S0 or dedup M2D0)
+static void encode_m2_payload(const uint8_t* R, const uint8_t* G, const uint8_t* B, int W, int H,
+                              ByteSink sink, void* ctx){
+    if(g_opt.progressive && g_opt.row_index) die("--progressive and --index cannot be combined");
+    if(g_opt.lossless && (g_opt.progressive || g_opt.row_index)) die("--lossless cannot be combined with --progressive/--index");
+    if(g_opt.sequence && (g_opt.progressive || g_opt.row_index || g_opt.lossless))
+        fail(MMSP_ERR_ARG, "--sequence cannot be combined with --progressive/--index/--lossless");
+    if(g_opt.dedup && (g_opt.progressive || g_opt.row_index || g_opt.lossless || g_opt.sequence))
+        fail(MMSP_ERR_ARG, "--dedup cannot be combined with --progressive/--index/--lossless/--sequence");
+    if(g_opt.sequence) encode_m2_sequence(R,G,B,W,H,sink,ctx);
+    else if(g_opt.dedup) encode_m2_dedup(R,G,B,W,H,sink,ctx);
+    else if(g_opt.progressive) encode_m2_progressive(R,G,B,W,H,sink,ctx);
+    else if(g_opt.row_index) encode_m2_indexed(R,G,B,W,H,sink,ctx);
+    else encode_m2_binary(R,G,B,W,H,1,sink,ctx);
+}
+
+/* ========================== Huffman (Method-3) ========================== */
+// Nodes live in one flat array (256 leaves + 255 internal at most) and refer
+// to their children by index. Each node caches the smallest symbol below it,
+// so the deterministic tie-break is O(1) per heap comparison.
+#define HUF_MAX_NODES 511
+typedef struct {
+    uint64_t freq;
+    int is_leaf;
+    int sym;              // 0..255 if leaf
+    int min_sym;          // smallest leaf symbol in this subtree
+    int l, r;             // child indices, -1 for leaves
+} HNode;
+
+typedef struct {
+    HNode node[HUF_MAX_NODES];
+    int n, root;
+} HufTree;
+
+static int hn_new_leaf(HufTree* t, int sym, uint64_t freq){
+    HNode* n = &t->node[t->n];
+    n->is_leaf=1; n->sym=sym; n->min_sym=sym; n->freq=freq;
+    n->l = n->r = -1;
+    return t->n++;
+}
+static int hn_new_internal(HufTree* t, int a, int b){
+    HNode* n = &t->node[t->n];
+    n->is_leaf=0; n->sym=-1;
+    n->l=a; n->r=b;
+    n->freq = t->node[a].freq + t->node[b].freq;
+    n->min_sym = (t->node[a].min_sym < t->node[b].min_sym) ? t->node[a].min_sym : t->node[b].min_sym;
+    return t->n++;
+}
+
+// deterministic compare: (freq, minSym, leaf first)
+static int hn_less(const HufTree* t, int xi, int yi){
+    const HNode* x = &t->node[xi];
+    const HNode* y = &t->node[yi];
+    if(x->freq != y->freq) return x->freq < y->freq;
+    if(x->min_sym != y->min_sym) return x->min_sym < y->min_sym;
+    // tie: leaf first
+    if(x->is_leaf != y->is_leaf) return x->is_leaf > y->is_leaf;
+    return 0;
+}
+
+typedef struct {
+    int a[256];
+    int sz;
+} MinHeap;
+
+static void heap_push(const HufTree* t, MinHeap* h, int n){
+    int i = h->sz++;
+    h->a[i]=n;
+    while(i>0){
+        int p=(i-1)/2;
+        if(!hn_less(t, h->a[i], h->a[p])) break;
+        int tmp=h->a[i]; h->a[i]=h->a[p]; h->a[p]=tmp;
+        i=p;
+    }
+}
+static int heap_pop(const HufTree* t, MinHeap* h){
+    int ret=h->a[0];
+    h->a[0]=h->a[--h->sz];
+    int i=0;
+    while(1){
+        int l=i*2+1, r=i*2+2, m=i;
+        if(l<h->sz && hn_less(t, h->a[l], h->a[m])) m=l;
+        if(r<h->sz && hn_less(t, h->a[r], h->a[m])) m=r;
+        if(m==i) break;
+        int tmp=h->a[i]; h->a[i]=h->a[m]; h->a[m]=tmp;
+        i=m;
+    }
+    return ret;
+}
+
+static void build_huffman(uint64_t freq[256], HufTree* t, int* unique_out){
+    MinHeap hp; hp.sz=0;
+    t->n=0;
+    int unique=0;
+    for(int s=0;s<256;s++){
+        if(freq[s]>0){
+            heap_push(t, &hp, hn_new_leaf(t, s, freq[s]));
+            unique++;
+        }
+    }
+    if(unique==0) die("empty payload for Huffman");
+    if(unique==1){
+        // special: create dummy internal node
+        int only = heap_pop(t, &hp);
+        int dummy = hn_new_leaf(t, (t->node[only].sym==0)?1:0, 0);
+        t->root = hn_new_internal(t, dummy, only);
+        *unique_out=unique;
+        return;
+    }
+    while(hp.sz>1){
+        int a = heap_pop(t, &hp);
+        int b = heap_pop(t, &hp);
+        // deterministic: ensure left is "smaller"
+        if(hn_less(t,b,a)){ int tmp=a; a=b; b=tmp; }
+        heap_push(t, &hp, hn_new_internal(t, a, b));
+    }
+    t->root = heap_pop(t, &hp);
+    *unique_out=unique;
+}
+
+static void gen_codes(const HufTree* t, int ni, char* buf, int depth, char* codes[256]){
+    const HNode* n = &t->node[ni];
+    if(n->is_leaf){
+        buf[depth]='\0';
+        const char* code = buf[0] ? buf : "0"; // if only one symbol, code "0"
+        codes[n->sym] = (char*)malloc(strlen(code)+1);
+        if(!codes[n->sym]) die("OOM");
+        strcpy(codes[n->sym], code);
+        return;
+    }
+    buf[depth]='0'; gen_codes(t, n->l, buf, depth+1, codes);
+    buf[depth]='1'; gen_codes(t, n->r, buf, depth+1, codes);
+}
+
+/* pack bits MSB-first */
+typedef struct {
+    uint8_t* data;
+    size_t bit_len;
+    size_t cap;
+} BitBuf;
+
+// empties b; the context's buffer keeps its capacity between calls
+static void bitbuf_init(BitBuf* b){
+    if(!b->data){
+        b->cap = 1024;
+        b->data = (uint8_t*)calloc(b->cap,1);
+        if(!b->data) die("OOM");
+    }else{
+        memset(b->data, 0, b->cap);
+    }
+    b->bit_len=0;
+}
+
+// Codes as right-aligned integers for the word-at-a-time packers below.
+// HUF_PACK_MAX keeps len + 7 pending bits inside the 64-bit accumulator; a
+// longer code needs a payload above ~10^11 bytes (Fibonacci bound).
+#define HUF_PACK_MAX 56
+typedef struct { uint64_t bits; int len; } HufCode;
+
+static void pack_codes(char* codes[256], HufCode out[256]){
+    for(int s=0;s<256;s++){
+        out[s].bits = 0; out[s].len = 0;
+        if(!codes[s]) continue;
+        int len = (int)strlen(codes[s]);
+        if(len > HUF_PACK_MAX) die("Huffman code longer than 56 bits");
+        for(int i=0;i<len;i++) out[s].bits = (out[s].bits<<1) | (uint64_t)(codes[s][i]=='1');
+        out[s].len = len;
+    }
+}
+
+static void bitbuf_push_bits(BitBuf* b, uint64_t bits, int len){
+    size_t need = (b->bit_len + (size_t)len + 7)/8 + 1;
+    if(need > b->cap){
+        size_t old = b->cap, nc = b->cap;
+        if(!grow_cap(&nc, need, 4096)) die("OOM");
+        uint8_t* nd = (uint8_t*)realloc(b->data, nc);
+        if(!nd) die("OOM");
+        memset(nd+old, 0, nc-old);
+        b->data = nd;
+        b->cap = nc;
+    }
+    for(int i=len-1;i>=0;){
+        size_t byte = b->bit_len / 8;
+        int off = (int)(b->bit_len % 8);
+        int take = 8-off; if(take > i+1) take = i+1;
+        uint8_t chunk = (uint8_t)((bits >> (i+1-take)) & ((1u<<take)-1));
+        b->data[byte] |= (uint8_t)(chunk << (8-off-take));
+        b->bit_len += (size_t)take;
+        i -= take;
+    }
+}
+
+// Huffman sink: packs each payload byte as soon as Method-2 emits it (one pass, no payload buffer)
+typedef struct {
+    BitBuf* bb;
+    const HufCode* codes;
+    uint64_t n;
+} HufSink;
+
+static void sink_huffman(void* ctx, const void* data, size_t n){
+    HufSink* hs = (HufSink*)ctx;
+    const uint8_t* p = (const uint8_t*)data;
+    for(size_t i=0;i<n;i++) bitbuf_push_bits(hs->bb, hs->codes[p[i]].bits, hs->codes[p[i]].len);
+    hs->n += n;
+}
+
+/* Parallel encode of an in-memory payload, bit-identical to the serial packer:
+   1. each thread sums the code lengths of its chunk,
+   2. a prefix sum gives every chunk its absolute bit offset,
+   3. each thread packs its chunk straight into the final buffer at that offset.
+   Chunks share at most one byte with their left neighbour; a chunk's first byte
+   goes to a side slot and is ORed in after the join, so no byte has two writers. */
+typedef struct {
+    const uint8_t* in;
+    size_t n;
+    const HufCode* codes;
+    uint64_t bit_off, bits;
+    uint8_t* out;
+    uint8_t head;       // first (shared) byte when bit_off is not byte-aligned
+} HufChunk;
+
+static void* huf_chunk_len(void* arg){
+    HufChunk* c = (HufChunk*)arg;
+    uint64_t bits = 0;
+    for(size_t i=0;i<c->n;i++) bits += (uint64_t)c->codes[c->in[i]].len;
+    c->bits = bits;
+    return NULL;
+}
+
+static void* huf_chunk_pack(void* arg){
+    HufChunk* c = (HufChunk*)arg;
+    int phase = (int)(c->bit_off % 8);
+    uint8_t* p = c->out + c->bit_off/8;
+    uint64_t acc = 0;   // low `pend` bits are pending, MSB first
+    int pend = phase;   // leading bits of the shared byte belong to the previous chunk (zeros here)
+    int first = (phase!=0);
+    for(size_t i=0;i<c->n;i++){
+        const HufCode hc = c->codes[c->in[i]];
+        acc = (acc << hc.len) | hc.bits;
+        pend += hc.len;
+        while(pend >= 8){
+            pend -= 8;
+            uint8_t byte = (uint8_t)(acc >> pend);
+            if(first){ c->head = byte; first = 0; p++; }
+            else *p++ = byte;
+        }
+    }
+    if(pend > 0){
+        uint8_t byte = (uint8_t)(acc << (8-pend));
+        if(first) c->head = byte;
+        else *p = byte;
+    }
+    return NULL;
+}
+
+static void huffman_encode_parallel(const uint8_t* in, size_t n, const HufCode codes[256], BitBuf* bb){
+    int T = thread_count();
+    if(n < (size_t)MMSP_PAR_MIN_BYTES) T = 1;
+    HufChunk ch[MAX_THREADS];
+    for(int k=0;k<T;k++){
+        size_t a = n*(size_t)k/(size_t)T, b = n*(size_t)(k+1)/(size_t)T;
+        ch[k].in = in + a; ch[k].n = b - a; ch[k].codes = codes; ch[k].head = 0;
+    }
+    run_parallel(T, huf_chunk_len, ch, sizeof(HufChunk));
+    uint64_t total = 0;
+    for(int k=0;k<T;k++){ ch[k].bit_off = total; total += ch[k].bits; }
+
+    size_t bytes = (size_t)((total + 7)/8);
+    if(bb->cap < bytes){
+        free(bb->data);
+        bb->cap = bytes;
+        bb->data = (uint8_t*)calloc(bb->cap,1);
+        if(!bb->data) die("OOM");
+    }else{
+        memset(bb->data, 0, bytes);
+    }
+    bb->bit_len = (size_t)total;
+    for(int k=0;k<T;k++) ch[k].out = bb->data;
+    run_parallel(T, huf_chunk_pack, ch, sizeof(HufChunk));
+    for(int k=0;k<T;k++) if(ch[k].bit_off % 8) bb->data[ch[k].bit_off/8] |= ch[k].head;
+}
+
+// Predefined byte model of a Method-2 binary payload. Records are little-endian int16
+// fields, so high bytes are almost always 0x00/0xFF and low bytes are small skips/levels.
+// Every byte keeps a nonzero count so any payload can be coded with this table.
+static void static_table_freq(uint64_t freq[256]){
+    static const uint32_t pos[8] = { 38000, 5000, 4000, 3000, 450, 200, 160, 130 }; // 0x00..0x07
+    static const uint32_t neg[8] = {  9300, 1600,  800,  400, 250, 120, 110, 100 }; // 0xFF..0xF8
+    for(int s=0;s<256;s++) freq[s]=1;
+    for(int i=0;i<8;i++){ freq[i]=pos[i]; freq[255-i]=neg[i]; }
+    for(int s=8;s<64;s++){ freq[s]=800/s; freq[255-s]=600/s; }
+}
+
+/* ========================== Compact eF residuals (Method-1) ========================== */
+// --ef compact[:K] stores each eF plane as round(eF * 2^K) in int16, Huffman-coded
+// over its little-endian bytes with the Method-3 builder:
+//   "EFC0" + K(u8) + count(u64) + used(u16) + used*(sym u8, len u8, code u64 right-aligned)
+//   + padbits(u8) + bit_bytes(u64) + MSB-first bitstream
+// Reconstruction error is at most 2^-(K+1) per coefficient (near-lossless for K >= 3).
+// Plain rounding keeps |eF| <= Q/2, but --lambda can zero whole levels, so a
+// residual that does not fit int16 at this K is an error rather than clipped.
+static int16_t ef_to_fixed(double e, int frac_bits){
+    long long v = llround(e * (double)(1<<frac_bits));
+    if(v > INT16_MAX || v < INT16_MIN)
+        fail(MMSP_ERR_ARG, "--ef compact:K: an eF residual does not fit int16 at this K (use a smaller K)");
+    return (int16_t)v;
+}
+
+// tree / bb: the context's scratch; returns the bytes written
+static uint64_t ef_compact_write(FILE* f, const int16_t* r, size_t n, int frac_bits, HufTree* tree, BitBuf* bb){
+    const uint8_t* bytes = (const uint8_t*)r;
+    size_t nb = n*sizeof(int16_t);
+    uint64_t freq[256]={0};
+    histogram_bytes(bytes, nb, 1, &freq);
+
+    int unique=0;
+    build_huffman(freq, tree, &unique);
+    char* codes[256]={0};
+    char buf[512];
+    gen_codes(tree, tree->root, buf, 0, codes);
+    HufCode hc[256];
+    pack_codes(codes, hc);
+    bitbuf_init(bb);
+    huffman_encode_parallel(bytes, nb, hc, bb);
+
+    uint8_t k = (uint8_t)frac_bits;
+    uint64_t cnt = n;
+    uint16_t used = 0;
+    for(int s=0;s<256;s++) if(codes[s]) used++;
+    fwrite("EFC0",1,4,f);
+    fwrite(&k,1,1,f);
+    fwrite(&cnt,8,1,f);
+    fwrite(&used,2,1,f);
+    for(int s=0;s<256;s++){
+        if(!codes[s]) continue;
+        uint8_t sym=(uint8_t)s, len=(uint8_t)hc[s].len;
+        fwrite(&sym,1,1,f);
+        fwrite(&len,1,1,f);
+        fwrite(&hc[s].bits,8,1,f);
+    }
+    uint8_t pb = (uint8_t)((8 - (bb->bit_len % 8)) % 8);
+    uint64_t bit_bytes = (bb->bit_len + 7)/8;
+    fwrite(&pb,1,1,f);
+    fwrite(&bit_bytes,8,1,f);
+    fwrite(bb->data,1,(size_t)bit_bytes,f);
+
+    for(int s=0;s<256;s++) free(codes[s]);
+    return 4+1+8+2 + (uint64_t)used*10 + 1+8 + bit_bytes;
+}
+
+/* ========================== Arithmetic coder (Method-4) ========================== */
+// Adaptive binary range coder (LZMA-style carry handling) over the quantized
+// coefficients. Unlike the byte Huffman of Method 3 it can spend well below
+// one bit on the very likely "zero" / "end of block" decisions.
+#define AC_PROB_BITS 11
+#define AC_PROB_ONE  (1u<<AC_PROB_BITS)
+#define AC_MOVE_BITS 4
+
+typedef struct {
+    uint64_t low;
+    uint32_t range;
+    uint8_t  cache;
+    uint64_t cache_size;
+    ByteBuf* out;
+} RcEnc;
+
+static void rc_init(RcEnc* rc, ByteBuf* out){
+    rc->low=0; rc->range=0xFFFFFFFFu;
+    rc->cache=0; rc->cache_size=1;
+    rc->out=out;
+}
+static void rc_shift_low(RcEnc* rc){
+    if((uint32_t)rc->low < 0xFF000000u || (rc->low>>32)!=0){
+        uint8_t carry = (uint8_t)(rc->low>>32);
+        uint8_t temp  = rc->cache;
+        do{
+            uint8_t b = (uint8_t)(temp + carry);
+            sink_mem(rc->out, &b, 1);
+            temp = 0xFF;
+        }while(--rc->cache_size != 0);
+        rc->cache = (uint8_t)(rc->low>>24);
+    }
+    rc->cache_size++;
+    rc->low = (rc->low & 0x00FFFFFFu) << 8;
+}
+static void rc_bit(RcEnc* rc, uint16_t* p, int bit){
+    uint32_t bound = (rc->range >> AC_PROB_BITS) * (*p);
+    if(!bit){
+        rc->range = bound;
+        *p += (uint16_t)((AC_PROB_ONE - *p) >> AC_MOVE_BITS);
+    }else{
+        rc->low += bound;
+        rc->range -= bound;
+        *p -= (uint16_t)(*p >> AC_MOVE_BITS);
+    }
+    while(rc->range < (1u<<24)){
+        rc->range <<= 8;
+        rc_shift_low(rc);
+    }
+}
+static void rc_flush(RcEnc* rc){
+    for(int i=0;i<5;i++) rc_shift_low(rc);
+}
+
+// Context model: every decision is conditioned on channel (Y/Cb/Cr) and zigzag index k
+typedef struct {
+    uint16_t zero[3][64];       // zz[k]==0 ?
+    uint16_t eob[3][64];        // all of zz[k..63]==0 ?
+    uint16_t size[3][64][16];   // unary bit length of |v|
+    uint16_t mant[3][16][16];   // mantissa bits, by bit length and bit position
+    uint16_t sign[3];
+} CoefModel;
+
+static void coef_model_init(CoefModel* cm){
+    uint16_t* p = (uint16_t*)cm;
+    for(size_t i=0;i<sizeof(*cm)/sizeof(uint16_t);i++) p[i] = AC_PROB_ONE/2;
+}
+
+static void ac_encode_level(RcEnc* rc, CoefModel* cm, int c, int k, int v){
+    int m = (v<0)? -v : v;
+    int nb = 0;
+    while((m>>nb)!=0) nb++;                       // 1..16
+    for(int i=1;i<nb;i++) rc_bit(rc, &cm->size[c][k][i-1], 1);
+    if(nb<16) rc_bit(rc, &cm->size[c][k][nb-1], 0);
+    for(int b=nb-2;b>=0;b--) rc_bit(rc, &cm->mant[c][nb-1][b], (m>>b)&1);
+    rc_bit(rc, &cm->sign[c], v<0);
+}
+
+// zz[0] is the DPCM DC difference; AC uses eob / zero-run / level decisions
+static void ac_encode_channel(RcEnc* rc, CoefModel* cm, int c, const int16_t zz[64]){
+    rc_bit(rc, &cm->zero[c][0], zz[0]==0);
+    if(zz[0]!=0) ac_encode_level(rc, cm, c, 0, zz[0]);
+
+    int last = 0;
+    for(int k=63;k>0;k--) if(zz[k]!=0){ last=k; break; }
+
+    int k=1;
+    while(k<64){
+        rc_bit(rc, &cm->eob[c][k], last<k);
+        if(last<k) break;
+        while(zz[k]==0){ rc_bit(rc, &cm->zero[c][k], 1); k++; }
+        rc_bit(rc, &cm->zero[c][k], 0);
+        ac_encode_level(rc, cm, c, k, zz[k]);
+        k++;
+    }
+}
+
+/* ========================== rANS (Method-5) ========================== */
+// Static byte-wise rANS over the Method-2 binary payload. Four states are
+// interleaved on one byte stream (symbol i uses state i%4), so the decoder's
+// four table lookups per step are independent of each other.
+// All payload fields are little-endian int16 at even offsets, so byte parity
+// (= lane parity) selects one of two tables: low bytes or high bytes.
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1u<<RANS_PROB_BITS)
+#define RANS_L (1u<<23)
+#define RANS_LANES 4
+
+// Scale byte counts to sum exactly RANS_PROB_SCALE, keeping every used symbol >= 1
+static void rans_normalize_freq(const uint64_t cnt[256], uint64_t total, uint16_t nf[256]){
+    uint32_t sum=0;
+    int maxs=0;
+    for(int s=0;s<256;s++){
+        if(cnt[s]==0){ nf[s]=0; continue; }
+        uint64_t f = (cnt[s]*RANS_PROB_SCALE)/total;
+        if(f==0) f=1;
+        nf[s]=(uint16_t)f;
+        sum += (uint32_t)f;
+        if(cnt[s] > cnt[maxs]) maxs=s;
+    }
+    // fix rounding on the most probable symbol, then on others if it would drop below 1
+    while(sum != RANS_PROB_SCALE){
+        if(sum < RANS_PROB_SCALE){ nf[maxs] += (uint16_t)(RANS_PROB_SCALE-sum); sum=RANS_PROB_SCALE; break; }
+        int best=-1;
+        for(int s=0;s<256;s++) if(nf[s]>1 && (best<0 || nf[s]>nf[best])) best=s;
+        if(best<0) die("rANS: cannot normalize frequencies");
+        uint32_t take = sum-RANS_PROB_SCALE;
+        if(take > (uint32_t)nf[best]-1) take = nf[best]-1;
+        nf[best] -= (uint16_t)take;
+        sum -= take;
+    }
+}
+
+// Encodes payload backwards into a buffer that is filled from its end; returns start pointer
+static uint8_t* rans_encode(const uint8_t* in, size_t n, const uint16_t nf[2][256],
+                            uint8_t* buf, size_t cap){
+    uint32_t cum[2][256];
+    for(int t=0;t<2;t++){
+        uint32_t c=0;
+        for(int s=0;s<256;s++){ cum[t][s]=c; c+=nf[t][s]; }
+    }
+
+    uint8_t* p = buf + cap;
+    uint32_t x[RANS_LANES];
+    for(int l=0;l<RANS_LANES;l++) x[l]=RANS_L;
+
+    for(size_t i=n;i-- > 0;){
+        uint32_t* st = &x[i % RANS_LANES];
+        int t = (int)(i & 1);
+        uint32_t f = nf[t][in[i]];
+        uint32_t x_max = ((RANS_L >> RANS_PROB_BITS) << 8) * f;
+        while(*st >= x_max){
+            if(p==buf) die("rANS: output buffer overflow");
+            *--p = (uint8_t)(*st & 0xFF);
+            *st >>= 8;
+        }
+        *st = ((*st / f) << RANS_PROB_BITS) + (*st % f) + cum[t][in[i]];
+    }
+    // flush last lane first so the decoder reads lane 0 first
+    for(int l=RANS_LANES-1;l>=0;l--){
+        if(p-buf < 4) die("rANS: output buffer overflow");
+        p -= 4;
+        p[0]=(uint8_t)(x[l]>>0);  p[1]=(uint8_t)(x[l]>>8);
+        p[2]=(uint8_t)(x[l]>>16); p[3]=(uint8_t)(x[l]>>24);
+    }
+    return p;
+}
+
+/* ========================== Method-1 raw coefficient files ========================== */
+// qF_*.raw / eF_*.raw: per block in raster order, 64 values in (u,v) row-major
+// order (int16 qF, float32 eF). The interleaved single file is
+//   "M1I0" + W,H,bw,bh (int32), then per block Y,Cb,Cr x (64 int16 qF, 64 float32 eF)
+#define M1_BLOCK_BYTES (3*64*(sizeof(int16_t)+sizeof(float)))
+
+/* ========================== Context ========================== */
+struct mmsp_encoder {
+    SeqRef seq;         // --sequence reference frame (kept between calls)
+    CoefModel cm;       // Method-4 context models (reset per call)
+    HufTree tree;       // Method-3 / eF compact code tree
+    ByteBuf payload;    // Method-2 payload (Methods 3/5), range-coder output (Method 4)
+    BitBuf bits;        // Huffman bitstream
+    char* part[MMSP_MAX_PARTS]; // results of the last call (open_memstream buffers)
+    size_t part_len[MMSP_MAX_PARTS];
+    int nparts;
+    char* rep;
+    size_t rep_len;
+    char err[200];
+    Call call;          // state of the running call (outlives its setjmp frame)
+};
+
+// the context's payload buffer, emptied; its capacity is kept between calls
+static ByteBuf* ctx_payload(void){
+    ByteBuf* b = &g_call->enc->payload;
+    b->len = 0;
+    return b;
+}
+// the context's --sequence reference frame
+static SeqRef* ctx_seq(void){ return &g_call->enc->seq; }
+
+/* ========================== Methods ==========================
+   Each writes the output parts of mmsp.h in command-line order. */
+static void encode_method0(void){
+    int W,H, has54=0; uint8_t hdr54[54];
+    uint8_t *R,*G,*B;
+    load_bmp_topdown_rgb(&W,&H,&R,&G,&B,hdr54,&has54);
+
+    TxtOut* fr=txt_wrap(part_out(0));
+    TxtOut* fg=txt_wrap(part_out(1));
+    TxtOut* fb=txt_wrap(part_out(2));
+    FILE* fd=part_out(3);
+
+    // dim.txt: first line W H, second line optional HDR54 hex
+    fprintf(fd,"%d %d\n",W,H);
+    if(has54){
+        fprintf(fd,"HDR54 ");
+        for(int i=0;i<54;i++) fprintf(fd,"%02X", hdr54[i]);
+        fprintf(fd,"\n");
+    }
+
+    const int PW = pad8(W);
+    for(int y=0;y<H;y++){
+        for(int x=0;x<W;x++){
+            if(x){ txt_putc(fr,' '); txt_putc(fg,' '); txt_putc(fb,' '); }
+            size_t o = (size_t)y*PW + x;
+            txt_put_uint(fr, R[o]);
+            txt_put_uint(fg, G[o]);
+            txt_put_uint(fb, B[o]);
+        }
+        txt_putc(fr,'\n'); txt_putc(fg,'\n'); txt_putc(fb,'\n');
+    }
+
+    txt_close(fr); txt_close(fg); txt_close(fb);
+    free(R); free(G); free(B);
+}
+
+/* ------------------ Method 1 ------------------ */
+// parts: Qt_Y Qt_Cb Qt_Cr dim, then qF x3 + eF x3 (4..9) or the interleaved coef (4)
+static void encode_method1(void){
+    if(g_opt.lossless) fail(MMSP_ERR_ARG, "Method-1: --lossless applies to Methods 2-5");
+    const int interleaved = g_opt.interleaved;
+    const int ef_bits = g_opt.ef_bits;
+    if(interleaved && ef_bits>=0) fail(MMSP_ERR_ARG, "Method-1: --ef compact needs the separate eF files");
+
+    // write QTs
+    write_qt_txt(part_out(0), QT_Y);
+    write_qt_txt(part_out(1), QT_C);
+    write_qt_txt(part_out(2), QT_C);
+
+    int W,H, has54=0; uint8_t hdr54[54];
+    uint8_t *R,*G,*B;
+    load_bmp_topdown_rgb(&W,&H,&R,&G,&B,hdr54,&has54);
+
+    FILE* fd=part_out(3);
+    fprintf(fd,"%d %d\n",W,H);
+    if(has54){
+        fprintf(fd,"HDR54 ");
+        for(int i=0;i<54;i++) fprintf(fd,"%02X", hdr54[i]);
+        fprintf(fd,"\n");
+    }
+
+    // qF/eF are staged per block row and written with one fwrite per file;
+    // the interleaved form is one "M1I0" file with all six per block
+    int bw=(W+7)/8, bh=(H+7)/8;
+    size_t nrow = (size_t)bw*64;
+    FILE* fq[3]={NULL,NULL,NULL};
+    FILE* fe[3]={NULL,NULL,NULL};
+    FILE* fi=NULL;
+    if(interleaved){
+        fi=part_out(4);
+        int32_t hdr[4] = { W, H, bw, bh };
+        fwrite("M1I0",1,4,fi);
+        fwrite(hdr,sizeof(hdr),1,fi);
+    }else{
+        for(int c=0;c<3;c++){
+            fq[c]=part_out(4+c);
+            if(ef_bits<0) fe[c]=part_out(7+c);
+        }
+    }
+    int16_t* qrow=(int16_t*)malloc(3*nrow*sizeof(int16_t)); // [c][bx*64 + u*8+v]
+    float*   erow=(float*)malloc(3*nrow*sizeof(float));
+    uint8_t* irow=(uint8_t*)malloc((size_t)bw*M1_BLOCK_BYTES);
+    if(!qrow||!erow||!irow) die("OOM");
+    // --ef compact: whole-plane fixed-point residuals, entropy coded at the end
+    int16_t* efix[3]={NULL,NULL,NULL};
+    if(ef_bits>=0){
+        for(int c=0;c<3;c++){
+            efix[c]=(int16_t*)malloc(nrow*(size_t)bh*sizeof(int16_t));
+            if(!efix[c]) die("OOM");
+        }
+    }
+
+    double sig[3][8][8]={0}, noi[3][8][8]={0};
+    double ref_err[3]={0};     // squared coefficient error vs the all-double transform
+    long long ref_qdiff[3]={0}; // quantized coefficients that differ from it
+
+    for(int by=0; by<bh; by++){
+        for(int bx=0; bx<bw; bx++){
+            double F[3][8][8], Fref[3][8][8];
+
+            forward_block(R,G,B,W,by,bx,g_opt.precision,g_opt.color_fixed,F);
+            if(g_opt.precision!=PREC_DOUBLE || g_opt.color_fixed){
+                // all-double reference for the precision report below
+                forward_block(R,G,B,W,by,bx,PREC_DOUBLE,0,Fref);
+                for(int c=0;c<3;c++){
+                    for(int u=0;u<8;u++){
+                        for(int v=0;v<8;v++){
+                            double d = F[c][u][v]-Fref[c][u][v];
+                            double Q = (c==0)? (double)QT_Y[u][v] : (double)QT_C[u][v];
+                            ref_err[c] += d*d;
+                            if(llround(F[c][u][v]/Q)!=llround(Fref[c][u][v]/Q)) ref_qdiff[c]++;
+                        }
+                    }
+                }
+            }
+
+            int16_t qb[3][8][8];
+            for(int c=0;c<3;c++)
+                for(int u=0;u<8;u++)
+                    for(int v=0;v<8;v++) qb[c][u][v] = (int16_t)llround(F[c][u][v]/((c==0)? QT_Y[u][v] : QT_C[u][v]));
+            if(g_opt.lambda>0) rdo_block(F, qb);
+
+            for(int c=0;c<3;c++){
+                int16_t* qo = qrow + c*nrow + (size_t)bx*64;
+                float*   eo = erow + c*nrow + (size_t)bx*64;
+                for(int u=0;u<8;u++){
+                    for(int v=0;v<8;v++){
+                        double q = (c==0)? (double)QT_Y[u][v] : (double)QT_C[u][v];
+                        double f = F[c][u][v];
+                        int16_t qi = qb[c][u][v];
+                        float   ei = (float)(f - (double)qi*q);
+                        qo[u*8+v] = qi;
+                        eo[u*8+v] = ei;
+                        if(efix[c]) efix[c][((size_t)by*bw+bx)*64 + u*8+v] = ef_to_fixed(f - (double)qi*q, ef_bits);
+                        sig[c][u][v]+=f*f;
+                        noi[c][u][v]+=(double)ei*(double)ei;
+                    }
+                }
+            }
+        }
+
+        if(interleaved){
+            uint8_t* p = irow;
+            for(int bx=0; bx<bw; bx++){
+                for(int c=0;c<3;c++){
+                    memcpy(p, qrow + c*nrow + (size_t)bx*64, 64*sizeof(int16_t)); p += 64*sizeof(int16_t);
+                    memcpy(p, erow + c*nrow + (size_t)bx*64, 64*sizeof(float));   p += 64*sizeof(float);
+                }
+            }
+            fwrite(irow, 1, (size_t)bw*M1_BLOCK_BYTES, fi);
+        }else{
+            for(int c=0;c<3;c++){
+                fwrite(qrow + c*nrow, sizeof(int16_t), nrow, fq[c]);
+                if(fe[c]) fwrite(erow + c*nrow, sizeof(float), nrow, fe[c]);
+            }
+        }
+    }
+
+    free(qrow); free(erow); free(irow);
+    free(R); free(G); free(B);
+    uint64_t ef_size[3]={0,0,0};
+    if(ef_bits>=0){
+        for(int c=0;c<3;c++){
+            ef_size[c] = ef_compact_write(part_out(7+c), efix[c], nrow*(size_t)bh, ef_bits,
+                                          &g_call->enc->tree, &g_call->enc->bits);
+            free(efix[c]);
+        }
+    }
+
+    // print SQNR_Freq 3x64
+    report("SQNR_Freq (dB) 3x64 (Y Cb Cr), order u=0..7 v=0..7\n");
+    const char* names[3]={"Y","Cb","Cr"};
+    for(int c=0;c<3;c++){
+        report("%s:\n", names[c]);
+        for(int u=0;u<8;u++){
+            for(int v=0;v<8;v++){
+                if(noi[c][u][v]<=0) report("INF");
+                else report("%.6f", 10.0*log10(sig[c][u][v]/noi[c][u][v]));
+                if(!(u==7 && v==7)) report(" ");
+            }
+        }
+        report("\n");
+    }
+    if(g_opt.precision!=PREC_DOUBLE || g_opt.color_fixed){
+        // the DCT is orthonormal, so coefficient MSE equals sample MSE (peak 255)
+        long long ncoef = (long long)bw*bh*64;
+        report("Precision %s%s vs double reference: PSNR (dB) / quantized coefficients changed\n",
+               PREC_NAME[g_opt.precision], g_opt.color_fixed? " + fixed colour" : "");
+        for(int c=0;c<3;c++){
+            double mse = ref_err[c]/(double)ncoef;
+            report("%s: ", names[c]);
+            if(mse<=0) report("INF");
+            else report("%.3f", 10.0*log10(255.0*255.0/mse));
+            report(" / %lld of %lld\n", ref_qdiff[c], ncoef);
+        }
+    }
+    if(ef_bits>=0){
+        long long ncoef = (long long)bw*bh*64;
+        report("eF compact (%d fraction bits): bytes / bits per coefficient (float32: %lld bytes)\n", ef_bits, ncoef*4);
+        for(int c=0;c<3;c++) report("%s: %llu / %.3f\n", names[c], (unsigned long long)ef_size[c], 8.0*ef_size[c]/(double)ncoef);
+    }
+    if(g_opt.lambda>0) rdo_report(-1);
+}
+
+/* ------------------ Method 2 (RLE) ------------------ */
+static void encode_method2(void){
+    if(g_opt.ascii && (g_opt.progressive || g_opt.row_index || g_opt.lossless || g_opt.sequence || g_opt.dedup))
+        fail(MMSP_ERR_ARG, "Method-2: --progressive/--index/--lossless/--sequence/--dedup need binary output");
+
+    int W,H, has54=0; uint8_t hdr54[54];
+    uint8_t *R,*G,*B;
+    load_bmp_topdown_rgb(&W,&H,&R,&G,&B,hdr54,&has54);
+
+    if(!g_opt.ascii){
+        encode_m2_payload(R,G,B,W,H,sink_file,part_out(0));
+    }else{
+        TxtOut* out = txt_wrap(part_out(0));
+        int bw=(W+7)/8, bh=(H+7)/8;
+        txt_put_int(out,W); txt_putc(out,' '); txt_put_int(out,H); txt_putc(out,'\n');
+
+        int16_t prevDC[3]={0,0,0};
+        for(int m=0;m<bh;m++){
+            for(int n=0;n<bw;n++){
+                int16_t q[3][8][8];
+                quantize_block(R,G,B,W,m,n,q);
+                for(int c=0;c<3;c++){
+                    Pair pairs[64];
+                    int pc = rle_channel(q[c], &prevDC[c], pairs);
+                    const char* ch = (c==0)?"Y":(c==1)?"Cb":"Cr";
+                    // "(m,n,CH) skip:val skip:val ..."
+                    txt_putc(out,'('); txt_put_int(out,m); txt_putc(out,',');
+                    txt_put_int(out,n); txt_putc(out,','); txt_puts(out,ch); txt_putc(out,')');
+                    for(int i=0;i<pc;i++){
+                        txt_putc(out,' '); txt_put_int(out,pairs[i].skip);
+                        txt_putc(out,':'); txt_put_int(out,pairs[i].val);
+                    }
+                    txt_putc(out,'\n');
+                }
+            }
+        }
+        txt_close(out);
+    }
+
+    free(R); free(G); free(B);
+    if(g_opt.lambda>0) rdo_report(0);
+}
+
+/* ------------------ Method 3 (Huffman over Method2-binary payload) ------------------ */
+// parts: codebook.txt, huffman_code
+static void encode_method3(void){
+    const int is_ascii = g_opt.ascii;
+    mmsp_encoder* enc = g_call->enc;
+
+    int W,H, has54=0; uint8_t hdr54[54];
+    uint8_t *R,*G,*B;
+    load_bmp_topdown_rgb(&W,&H,&R,&G,&B,hdr54,&has54);
+
+    // Table selection:
+    //   optimal: two passes, exact byte frequencies of the whole payload (archival)
+    //   static : one pass, predefined table, the raw payload is never held in memory
+    //   sampled: statistics from every N-th block, then one coding pass
+    // The coded bits are still buffered whole: codebook.txt and the M3B1 header
+    // carry payload_size / bit_bytes ahead of the data, so nothing can be emitted
+    // before the last block is coded.
+    const int table = g_opt.huf_table;
+    uint64_t freq[256]={0};
+    ByteBuf* payload = ctx_payload();
+    if(table==HUF_TABLE_OPTIMAL){
+        encode_m2_payload(R,G,B,W,H,sink_mem,payload);
+        if(payload->len==0) die("Method-3: empty payload");
+        histogram_bytes(payload->data, payload->len, 1, &freq);
+    }else if(table==HUF_TABLE_STATIC){
+        static_table_freq(freq);
+    }else{
+        encode_m2_binary(R,G,B,W,H,g_opt.sample_every,sink_hist,freq);
+        for(int s=0;s<256;s++) freq[s]++; // unseen bytes must stay codable
+        memset(&g_rdo, 0, sizeof(g_rdo)); // report the coding pass only
+    }
+
+    int unique=0;
+    HufTree* tree = &enc->tree;
+    build_huffman(freq, tree, &unique);
+
+    char* codes[256]={0};
+    char buf[512];
+    gen_codes(tree, tree->root, buf, 0, codes);
+
+    // encode bitstream
+    HufCode hcodes[256];
+    pack_codes(codes, hcodes);
+    BitBuf* bb = &enc->bits;
+    bitbuf_init(bb);
+    uint64_t sz;
+    if(table==HUF_TABLE_OPTIMAL){
+        huffman_encode_parallel(payload->data, payload->len, hcodes, bb);
+        sz = payload->len;
+    }else{
+        HufSink hs = { bb, hcodes, 0 };
+        encode_m2_payload(R,G,B,W,H,sink_huffman,&hs);
+        sz = hs.n;
+    }
+    free(R); free(G); free(B);
+    int padbits = (int)((8 - (bb->bit_len % 8)) % 8);
+    // (already 0-filled due to calloc/realloc memset)
+
+    // write codebook (your format)
+    FILE* fc = part_out(0);
+    fprintf(fc,"M3_BYTE_HUFFMAN\n");
+    fprintf(fc,"payload_size %llu\n", (unsigned long long)sz);
+    fprintf(fc,"unique %d\n", unique);
+    if(table!=HUF_TABLE_OPTIMAL) fprintf(fc,"table %s\n", HUF_TABLE_NAME[table]);
+    for(int s=0;s<256;s++){
+        if(freq[s]>0){
+            fprintf(fc,"%d %llu %s\n", s, (unsigned long long)freq[s], codes[s]);
+        }
+    }
+
+    if(is_ascii){
+        FILE* fh = part_out(1);
+        if(table==HUF_TABLE_OPTIMAL) fprintf(fh,"M3\n");
+        else fprintf(fh,"M3 %s\n", HUF_TABLE_NAME[table]);
+        fprintf(fh,"payload_size %llu\n", (unsigned long long)sz);
+        fprintf(fh,"padbits %d\n", padbits);
+        TxtOut* tb = txt_wrap(fh);
+        // print bits as lines (80 chars/line)
+        size_t total_bits = bb->bit_len;
+        size_t printed=0;
+        while(printed<total_bits){
+            size_t line = (total_bits-printed>80)?80:(total_bits-printed);
+            for(size_t k=0;k<line;k++){
+                size_t idx = printed+k;
+                uint8_t byte = bb->data[idx/8];
+                int bit = (byte >> (7-(idx%8))) & 1;
+                txt_putc(tb, bit?'1':'0');
+            }
+            txt_putc(tb, '\n');
+            printed += line;
+        }
+        txt_close(tb);
+    }else{
+        FILE* fh = part_out(1);
+        // binary header: "M3B0" + payload_size(u32) + padbits(u8) + bit_bytes(u32) + data
+        // non-optimal tables: "M3B1" + table(u8) + the same fields
+        // "M3B2" / "M3B3": the same with payload_size and bit_bytes as u64
+        uint64_t bit_bytes = (bb->bit_len + 7)/8;
+        int wide = sz > MMSP_SIZE32_MAX || bit_bytes > MMSP_SIZE32_MAX;
+        char magic[5] = "M3B0";
+        magic[3] = (char)('0' + (table!=HUF_TABLE_OPTIMAL) + 2*wide);
+        fwrite(magic,1,4,fh);
+        if(table!=HUF_TABLE_OPTIMAL){
+            uint8_t tb = (uint8_t)table;
+            fwrite(&tb,1,1,fh);
+        }
+        uint8_t pb = (uint8_t)padbits;
+        sink_size(sink_file, fh, sz, wide);
+        fwrite(&pb,1,1,fh);
+        sink_size(sink_file, fh, bit_bytes, wide);
+        fwrite(bb->data,1,(size_t)bit_bytes,fh);
+    }
+
+    // cleanup
+    for(int s=0;s<256;s++) free(codes[s]);
+
+    if(g_opt.lambda>0) rdo_report(1);
+}
+
+/* ------------------ Method 4 (adaptive arithmetic coding of coefficients) ------------------ */
+static void encode_method4(void){
+    int W,H, has54=0; uint8_t hdr54[54];
+    uint8_t *R,*G,*B;
+    load_bmp_topdown_rgb(&W,&H,&R,&G,&B,hdr54,&has54);
+
+    int bw=(W+7)/8, bh=(H+7)/8;
+    CoefModel* cm = &g_call->enc->cm;
+    coef_model_init(cm);
+
+    ByteBuf* code = ctx_payload();
+    RcEnc rc; rc_init(&rc, code);
+    int16_t prevDC[3]={0,0,0};
+    for(int m=0;m<bh;m++){
+        for(int n=0;n<bw;n++){
+            if(g_opt.lossless){
+                int16_t zz[3][64];
+                lossless_block_zz(R,G,B,W,m,n,prevDC,zz);
+                for(int c=0;c<3;c++) ac_encode_channel(&rc, cm, c, zz[c]);
+                continue;
+            }
+            int16_t q[3][8][8];
+            quantize_block(R,G,B,W,m,n,q);
+            for(int c=0;c<3;c++){
+                int16_t zz[64];
+                zigzag_dpcm(q[c], &prevDC[c], zz);
+                ac_encode_channel(&rc, cm, c, zz);
+            }
+        }
+    }
+    rc_flush(&rc);
+
+    // binary header: "M4A0" + W,H,bw,bh (int32) + code_bytes(u32) + range-coded data
+    // ("M4L0" for --lossless: YCoCg-R lifting coefficients in ZZ_FULL order;
+    //  "M4A1" / "M4L1": code_bytes u64)
+    FILE* out = part_out(0);
+    int wide = code->len > MMSP_SIZE32_MAX;
+    char magic[5] = "M4A0";
+    if(g_opt.lossless) magic[2] = 'L';
+    if(wide) magic[3] = '1';
+    fwrite(magic,1,4,out);
+    int32_t hdr[4] = { W, H, bw, bh };
+    fwrite(hdr,sizeof(hdr),1,out);
+    sink_size(sink_file, out, code->len, wide);
+    fwrite(code->data,1,code->len,out);
+
+    free(R); free(G); free(B);
+    if(g_opt.lambda>0) rdo_report(0);
+}
+
+/* ------------------ Method 5 (4-way interleaved rANS over Method2-binary payload) ------------------ */
+static void encode_method5(void){
+    int W,H, has54=0; uint8_t hdr54[54];
+    uint8_t *R,*G,*B;
+    load_bmp_topdown_rgb(&W,&H,&R,&G,&B,hdr54,&has54);
+
+    ByteBuf* payload = ctx_payload();
+    encode_m2_payload(R,G,B,W,H,sink_mem,payload);
+    free(R); free(G); free(B);
+
+    uint64_t freq[2][256]={{0}};
+    histogram_bytes(payload->data, payload->len, 2, freq);
+    uint16_t nf[2][256];
+    for(int t=0;t<2;t++) rans_normalize_freq(freq[t], (payload->len + 1 - t)/2, nf[t]);
+
+    // worst case: every symbol renormalizes by 2 bytes, plus 4 flushed states
+    size_t cap = payload->len*2 + 4*RANS_LANES + 16;
+    if(payload->len > (SIZE_MAX - 4*RANS_LANES - 16)/2) die("OOM");
+    uint8_t* buf = (uint8_t*)malloc(cap);
+    if(!buf) die("OOM");
+    uint8_t* code = rans_encode(payload->data, payload->len, nf, buf, cap);
+    uint64_t code_bytes = (uint64_t)(buf + cap - code);
+
+    // binary header: "M5R0" + payload_size(u32)
+    //   + 2 tables (even/odd bytes): used(u16) + used*(sym u8, freq u16), each summing to 4096
+    //   + code_bytes(u32) + data
+    // ("M5R1": payload_size and code_bytes u64)
+    FILE* out = part_out(0);
+    int wide = payload->len > MMSP_SIZE32_MAX || code_bytes > MMSP_SIZE32_MAX;
+    fwrite(wide ? "M5R1" : "M5R0",1,4,out);
+    sink_size(sink_file, out, payload->len, wide);
+    for(int t=0;t<2;t++){
+        uint16_t used=0;
+        for(int s=0;s<256;s++) if(nf[t][s]) used++;
+        fwrite(&used,2,1,out);
+        for(int s=0;s<256;s++){
+            if(!nf[t][s]) continue;
+            uint8_t sym=(uint8_t)s;
+            fwrite(&sym,1,1,out);
+            fwrite(&nf[t][s],2,1,out);
+        }
+    }
+    sink_size(sink_file, out, code_bytes, wide);
+    fwrite(code,1,(size_t)code_bytes,out);
+
+    free(buf);
+    if(g_opt.lambda>0) rdo_report(0);
+}
+
+/* ========================== API (mmsp.h) ========================== */
+static void init_tables(void){
+    init_dct_table();
+    rdo_init();
+}
+
+mmsp_encoder* mmsp_encoder_create(void){
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_tables);
+    return (mmsp_encoder*)calloc(1, sizeof(mmsp_encoder));
+}
+
+static void release_result(mmsp_encoder* enc){
+    for(int k=0;k<enc->nparts;k++) (free)(enc->part[k]); // open_memstream buffers
+    (free)(enc->rep);
+    enc->nparts = 0;
+    enc->rep = NULL;
+    enc->rep_len = 0;
+}
+
+void mmsp_encoder_destroy(mmsp_encoder* enc){
+    if(!enc) return;
+    release_result(enc);
+    free(enc->payload.data);
+    free(enc->bits.data);
+    (free)(enc->seq.R); (free)(enc->seq.G); (free)(enc->seq.B); (free)(enc->seq.zz);
+    free(enc);
+}
+
+const char* mmsp_encoder_error(const mmsp_encoder* enc){
+    return enc->err;
+}
+
+void mmsp_encoder_seq_reset(mmsp_encoder* enc){
+    enc->seq.valid = 0;
+}
+
+static void (*const ENCODE_METHOD[6])(void) = {
+    encode_method0, encode_method1, encode_method2, encode_method3, encode_method4, encode_method5
+};
+
+int mmsp_encode(mmsp_encoder* enc, const mmsp_enc_params* p,
+                const uint8_t* bmp, size_t bmp_len, mmsp_result* out){
+    release_result(enc);
+    memset(out, 0, sizeof(*out));
+    enc->err[0] = '\0';
+
+    Call* cl = &enc->call;
+    memset(cl, 0, sizeof(*cl));
+    cl->live.l.prev = cl->live.l.next = &cl->live;
+    cl->enc = enc;
+    g_call = cl;
+
+    if(setjmp(cl->fail)==0){
+        set_options(p);
+        memset(&g_rdo, 0, sizeof(g_rdo));
+        cl->in = bmp_len ? fmemopen((void*)bmp, bmp_len, "rb") : NULL;
+        if(!cl->in) die("empty or unreadable BMP input");
+        ENCODE_METHOD[g_opt.method]();
+        cl->status = MMSP_OK;
+    }else{
+        // buffers the context grew during this call are freed with the call's blocks
+        if(enc->payload.data && mem_tracked(enc->payload.data)) memset(&enc->payload, 0, sizeof(enc->payload));
+        if(enc->bits.data && mem_tracked(enc->bits.data)) memset(&enc->bits, 0, sizeof(enc->bits));
+        enc->seq.valid = 0; // the next frame is a key frame
+        snprintf(enc->err, sizeof(enc->err), "%s", cl->msg);
+    }
+
+    if(cl->in) fclose(cl->in);
+    for(int k=0;k<cl->nout;k++){
+        if(cl->out[k]) fclose(cl->out[k]); // sets out_data / out_len
+        if(cl->status!=MMSP_OK) (free)(cl->out_data[k]);
+    }
+    if(cl->rep) fclose(cl->rep);
+    if(cl->status!=MMSP_OK){
+        (free)(cl->rep_data);
+        for(MemHdr* h=cl->live.l.next; h!=&cl->live; ){ MemHdr* nx=h->l.next; (free)(h); h=nx; }
+    }else{
+        // whatever is still live belongs to the context now
+        while(cl->live.l.next != &cl->live) mem_unlink(cl->live.l.next);
+        enc->nparts = cl->nout;
+        for(int k=0;k<cl->nout;k++){ enc->part[k] = cl->out_data[k]; enc->part_len[k] = cl->out_len[k]; }
+        enc->rep = cl->rep_data;
+        enc->rep_len = cl->rep_len;
+        out->nparts = enc->nparts;
+        for(int k=0;k<enc->nparts;k++){
+            out->part[k].data = (const uint8_t*)enc->part[k];
+            out->part[k].len = enc->part_len[k];
+        }
+        out->report.data = (const uint8_t*)enc->rep;
+        out->report.len = enc->rep_len;
+    }
+    g_call = NULL;
+    return cl->status;
+}
+
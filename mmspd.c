@@ -0,0 +1,542 @@
+// mmspd.c — resident codec service over a Unix domain socket (API in mmsp.h)
+// One process serves many encode/decode jobs, so the per-image process start,
+// table set-up and context allocation of the encoder/decoder CLIs are paid once.
+//
+//   mmspd SOCKET serve [--workers N] [--queue N]
+//   mmspd SOCKET encode METHOD [--ascii|--progressive|--index|--lossless] input.bmp out...
+//   mmspd SOCKET decode METHOD [--ascii] out.bmp in...
+//   mmspd SOCKET stats
+//
+// encode/decode take the files of the encoder/decoder command lines for that
+// method (decode sends dim.txt from the current directory, as decoder does).
+//
+// Server: the main thread accepts connections into a bounded queue; a fixed pool
+// of workers, each with its own mmsp_encoder/mmsp_decoder, serves one job per
+// connection. When the queue is full the accept loop blocks, so further clients
+// wait in the listen backlog (backpressure) instead of piling up in memory.
+//
+// Wire format (little-endian):
+//   request:  "MJ01" op(u8: 'E','D','S') method(u8) flags(u8) nparts(u8)
+//             nparts * (len u32 + bytes) [+ len u32 + dim.txt if FLAG_DIM]
+//   response: status(u8, mmsp_status) nparts(u8) nparts * (len u32 + bytes)
+//             (on error one part with the message; for 'S' one text part)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mmsp.h"
+
+static void die(const char* msg){
+    fprintf(stderr, "ERROR: %s\n", msg);
+    exit(1);
+}
+
+static void usage(void){
+    printf("Usage:\n");
+    printf("  mmspd SOCKET serve [--workers N] [--queue N]   (default: all CPUs, queue 64)\n");
+    printf("  mmspd SOCKET encode METHOD [options] input.bmp out...   (files as for encoder)\n");
+    printf("  mmspd SOCKET decode METHOD [--ascii] out.bmp in...      (files as for decoder)\n");
+    printf("  mmspd SOCKET stats\n");
+    printf("Options (encode): --ascii --progressive --index --lossless\n");
+}
+
+enum { FLAG_ASCII=1, FLAG_DIM=2, FLAG_PROGRESSIVE=4, FLAG_INDEX=8, FLAG_LOSSLESS=16 };
+
+#define MAX_PART_BYTES (1u<<30)     // per part, guards the worker against bogus lengths
+#define IO_TIMEOUT_SEC 30           // a stalled client releases its worker after this
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+/* ========================== Socket I/O ========================== */
+static int read_full(int fd, void* buf, size_t n){
+    uint8_t* p = (uint8_t*)buf;
+    while(n){
+        ssize_t k = read(fd, p, n);
+        if(k<0 && errno==EINTR) continue;
+        if(k<=0) return 0;
+        p += k; n -= (size_t)k;
+    }
+    return 1;
+}
+static int write_full(int fd, const void* buf, size_t n){
+    const uint8_t* p = (const uint8_t*)buf;
+    while(n){
+        ssize_t k = write(fd, p, n);
+        if(k<0 && errno==EINTR) continue;
+        if(k<=0) return 0;
+        p += k; n -= (size_t)k;
+    }
+    return 1;
+}
+
+// len u32 + bytes; *data is malloc'd (NULL when len is 0)
+static int read_blob(int fd, mmsp_buf* b){
+    uint32_t len=0;
+    if(!read_full(fd,&len,4) || len>MAX_PART_BYTES) return 0;
+    uint8_t* data = NULL;
+    if(len){
+        data = (uint8_t*)malloc(len);
+        if(!data || !read_full(fd,data,len)){ free(data); return 0; }
+    }
+    b->data = data;
+    b->len = len;
+    return 1;
+}
+static int write_blob(int fd, const void* data, size_t len){
+    if(len>MAX_PART_BYTES) return 0;   // the u32 length field is capped, never truncated
+    uint32_t n = (uint32_t)len;
+    return write_full(fd,&n,4) && (len==0 || write_full(fd,data,len));
+}
+
+/* ========================== Statistics ========================== */
+// latency histograms in power-of-two microsecond buckets: [2^(b-1), 2^b) us
+#define LAT_BUCKETS 32
+#define MAX_QUEUE 4096
+
+typedef struct {
+    pthread_mutex_t mu;
+    unsigned long long jobs, failed, rejected;
+    unsigned long long wait_hist[LAT_BUCKETS];    // accept -> worker pick-up
+    unsigned long long serve_hist[LAT_BUCKETS];   // request read -> response written
+    unsigned long long depth_hist[MAX_QUEUE+1];   // queue depth seen by each new job
+    int depth_max;
+} Stats;
+
+static Stats g_stats = { .mu = PTHREAD_MUTEX_INITIALIZER };
+
+static int lat_bucket(double sec){
+    double us = sec*1e6;
+    int b = 0;
+    while(b<LAT_BUCKETS-1 && us >= 1.0){ us *= 0.5; b++; }
+    return b;
+}
+
+static void stats_print_hist(FILE* f, const char* title, const unsigned long long* h){
+    fprintf(f, "%s (us):\n", title);
+    for(int b=0;b<LAT_BUCKETS;b++){
+        if(!h[b]) continue;
+        unsigned long long lo = b ? 1ull<<(b-1) : 0, hi = 1ull<<b;
+        fprintf(f, "  [%10llu, %10llu) %llu\n", lo, hi, h[b]);
+    }
+}
+
+/* ========================== Job queue ========================== */
+typedef struct {
+    int fd;
+    int depth;          // queue depth when it was enqueued
+    double t_accept;
+} Job;
+
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t not_empty, not_full;
+    Job* ring;
+    int cap, head, count;
+    int closed;
+    int workers;
+} Queue;
+
+static Queue g_q = { .mu = PTHREAD_MUTEX_INITIALIZER,
+                     .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER };
+
+static volatile sig_atomic_t g_stop;
+
+// blocks while the queue is full; returns 0 once shutdown has started
+// (the wait wakes up periodically: a signal handler cannot signal the condition)
+static int queue_push(Job j){
+    pthread_mutex_lock(&g_q.mu);
+    while(g_q.count==g_q.cap && !g_stop){
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100*1000*1000;
+        if(ts.tv_nsec >= 1000000000L){ ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+        pthread_cond_timedwait(&g_q.not_full, &g_q.mu, &ts);
+    }
+    if(g_stop){ pthread_mutex_unlock(&g_q.mu); return 0; }
+    j.depth = g_q.count;
+    g_q.ring[(g_q.head + g_q.count) % g_q.cap] = j;
+    g_q.count++;
+    pthread_cond_signal(&g_q.not_empty);
+    pthread_mutex_unlock(&g_q.mu);
+    return 1;
+}
+// returns 0 when the queue is closed and drained
+static int queue_pop(Job* j){
+    pthread_mutex_lock(&g_q.mu);
+    while(g_q.count==0 && !g_q.closed) pthread_cond_wait(&g_q.not_empty, &g_q.mu);
+    if(g_q.count==0){ pthread_mutex_unlock(&g_q.mu); return 0; }
+    *j = g_q.ring[g_q.head];
+    g_q.head = (g_q.head + 1) % g_q.cap;
+    g_q.count--;
+    pthread_cond_signal(&g_q.not_full);
+    pthread_mutex_unlock(&g_q.mu);
+    return 1;
+}
+
+/* ========================== Worker ========================== */
+typedef struct {
+    mmsp_encoder* enc;     // per-thread contexts: tables and scratch warm up once
+    mmsp_decoder* dec;
+} Worker;
+
+static void respond_error(int fd, int status, const char* msg){
+    uint8_t h[2] = { (uint8_t)status, 1 };
+    if(write_full(fd,h,2)) write_blob(fd,msg,strlen(msg));
+}
+
+static char* stats_text(size_t* len){
+    char* text=NULL;
+    FILE* f = open_memstream(&text, len);
+    if(!f) return NULL;
+    pthread_mutex_lock(&g_q.mu);
+    int depth = g_q.count, cap = g_q.cap, workers = g_q.workers;
+    pthread_mutex_unlock(&g_q.mu);
+
+    pthread_mutex_lock(&g_stats.mu);
+    fprintf(f, "jobs %llu failed %llu rejected %llu\n", g_stats.jobs, g_stats.failed, g_stats.rejected);
+    fprintf(f, "workers %d queue depth %d max %d capacity %d\n", workers, depth, g_stats.depth_max, cap);
+    fprintf(f, "queue depth at enqueue:\n");
+    for(int d=0;d<=cap;d++) if(g_stats.depth_hist[d]) fprintf(f, "  %4d %llu\n", d, g_stats.depth_hist[d]);
+    stats_print_hist(f, "queue wait", g_stats.wait_hist);
+    stats_print_hist(f, "service time", g_stats.serve_hist);
+    pthread_mutex_unlock(&g_stats.mu);
+    fclose(f);
+    return text;
+}
+
+// one request/response on fd; returns the mmsp_status sent, or -1 if the request was unreadable
+// *is_stats: it was a stats query (kept out of the statistics it reports)
+static int serve_job(Worker* w, int fd, int* is_stats){
+    *is_stats = 0;
+    uint8_t h[8];
+    if(!read_full(fd,h,8) || memcmp(h,"MJ01",4)!=0){
+        respond_error(fd, MMSP_ERR_FORMAT, "bad request header");
+        return -1;
+    }
+    const int op = h[4], method = h[5], flags = h[6], nparts = h[7];
+    if(op=='S'){
+        *is_stats = 1;
+        size_t len=0;
+        char* text = stats_text(&len);
+        if(!text){ respond_error(fd, MMSP_ERR_NOMEM, "OOM"); return MMSP_ERR_NOMEM; }
+        uint8_t r[2] = { MMSP_OK, 1 };
+        if(write_full(fd,r,2)) write_blob(fd,text,len);
+        free(text);
+        return MMSP_OK;
+    }
+    if((op!='E' && op!='D') || nparts>MMSP_MAX_PARTS){
+        respond_error(fd, MMSP_ERR_ARG, "bad request op or part count");
+        return -1;
+    }
+
+    mmsp_buf in[MMSP_MAX_PARTS+1];
+    memset(in,0,sizeof(in));
+    int nread = 0, ok = 1;
+    int nblobs = nparts + ((flags & FLAG_DIM) ? 1 : 0);
+    while(ok && nread<nblobs) ok = read_blob(fd, &in[nread++]);
+    if(!ok){
+        respond_error(fd, MMSP_ERR_FORMAT, "short request");
+        for(int k=0;k<nread;k++) free((void*)in[k].data);
+        return -1;
+    }
+
+    mmsp_result r;
+    int st;
+    const char* err;
+    if(op=='E'){
+        mmsp_enc_params p;
+        mmsp_enc_params_init(&p);
+        p.method = method;
+        p.ascii = (flags & FLAG_ASCII)!=0;
+        p.progressive = (flags & FLAG_PROGRESSIVE)!=0;
+        p.row_index = (flags & FLAG_INDEX)!=0;
+        p.lossless = (flags & FLAG_LOSSLESS)!=0;
+        p.threads = 1; // the pool already keeps every CPU busy
+        if(nparts!=1){
+            st = MMSP_ERR_ARG;
+            err = "encode takes one BMP";
+        }else{
+            st = mmsp_encode(w->enc, &p, in[0].data, in[0].len, &r);
+            err = mmsp_encoder_error(w->enc);
+        }
+    }else{
+        mmsp_dec_params p;
+        mmsp_dec_params_init(&p);
+        p.method = method;
+        p.ascii = (flags & FLAG_ASCII)!=0;
+        if(flags & FLAG_DIM) p.dim = in[nparts];
+        st = mmsp_decode(w->dec, &p, in, nparts, &r);
+        err = mmsp_decoder_error(w->dec);
+    }
+
+    if(st==MMSP_OK){
+        // larger results do not fit the wire format: use the library or CLIs directly
+        for(int k=0;k<r.nparts;k++) if(r.part[k].len>MAX_PART_BYTES){
+            st = MMSP_ERR_NOMEM;
+            err = "result part too large for mmspd (1 GB per part)";
+        }
+    }
+    if(st!=MMSP_OK) respond_error(fd, st, err);
+    else{
+        uint8_t rh[2] = { MMSP_OK, (uint8_t)r.nparts };
+        int wok = write_full(fd,rh,2);
+        for(int k=0;wok && k<r.nparts;k++) wok = write_blob(fd, r.part[k].data, r.part[k].len);
+    }
+    for(int k=0;k<nblobs;k++) free((void*)in[k].data);
+    return st;
+}
+
+static void* worker_main(void* arg){
+    Worker* w = (Worker*)arg;
+    Job j;
+    while(queue_pop(&j)){
+        double t0 = now_sec();
+        int is_stats;
+        int st = serve_job(w, j.fd, &is_stats);
+        double t1 = now_sec();
+        close(j.fd);
+        if(is_stats) continue;
+
+        // every counter and histogram covers the same jobs (depth included)
+        pthread_mutex_lock(&g_stats.mu);
+        g_stats.jobs++;
+        g_stats.depth_hist[j.depth]++;
+        if(j.depth+1 > g_stats.depth_max) g_stats.depth_max = j.depth+1;
+        if(st<0) g_stats.rejected++;
+        else if(st!=MMSP_OK) g_stats.failed++;
+        g_stats.wait_hist[lat_bucket(t0 - j.t_accept)]++;
+        g_stats.serve_hist[lat_bucket(t1 - t0)]++;
+        pthread_mutex_unlock(&g_stats.mu);
+    }
+    return NULL;
+}
+
+/* ========================== Server ========================== */
+static void on_signal(int sig){ (void)sig; g_stop = 1; }
+
+static void fill_addr(struct sockaddr_un* a, const char* path){
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(a->sun_path)) die("socket path too long");
+    strcpy(a->sun_path, path);
+}
+
+static int serve(const char* path, int workers, int qcap){
+    if(workers<=0){
+        long c = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (c>0) ? (int)c : 1;
+    }
+    if(qcap<1 || qcap>MAX_QUEUE) die("--queue N needs 1 <= N <= 4096");
+
+    struct sockaddr_un addr;
+    fill_addr(&addr, path);
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(ls<0) die("socket failed");
+    unlink(path); // a stale socket from a previous run
+    if(bind(ls,(struct sockaddr*)&addr,sizeof(addr))!=0) die("bind failed");
+    if(listen(ls, qcap)!=0) die("listen failed");
+
+    // SIGINT/SIGTERM stop accepting and let the workers drain the queue;
+    // no SA_RESTART so accept() returns
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN); // a client that hangs up only fails its own job
+
+    g_q.ring = (Job*)calloc((size_t)qcap, sizeof(Job));
+    Worker* w = (Worker*)calloc((size_t)workers, sizeof(Worker));
+    pthread_t* th = (pthread_t*)calloc((size_t)workers, sizeof(pthread_t));
+    if(!g_q.ring || !w || !th) die("OOM");
+    g_q.cap = qcap;
+    g_q.workers = workers;
+    // workers inherit a mask without SIGINT/SIGTERM so the signal interrupts accept()
+    sigset_t sigs, old;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old);
+    for(int k=0;k<workers;k++){
+        w[k].enc = mmsp_encoder_create();
+        w[k].dec = mmsp_decoder_create();
+        if(!w[k].enc || !w[k].dec) die("OOM");
+        if(pthread_create(&th[k], NULL, worker_main, &w[k])!=0) die("pthread_create failed");
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    fprintf(stderr, "mmspd: listening on %s (%d workers, queue %d)\n", path, workers, qcap);
+
+    while(!g_stop){
+        int fd = accept(ls, NULL, NULL);
+        if(fd<0){
+            if(errno==EINTR || errno==ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        struct timeval tv = { IO_TIMEOUT_SEC, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        Job j = { .fd = fd, .t_accept = now_sec() };
+        if(!queue_push(j)) close(fd);
+    }
+
+    close(ls);
+    unlink(path);
+    pthread_mutex_lock(&g_q.mu);
+    g_q.closed = 1;
+    pthread_cond_broadcast(&g_q.not_empty);
+    pthread_mutex_unlock(&g_q.mu);
+    for(int k=0;k<workers;k++){
+        pthread_join(th[k], NULL);
+        mmsp_encoder_destroy(w[k].enc);
+        mmsp_decoder_destroy(w[k].dec);
+    }
+    free(th); free(w); free(g_q.ring);
+    fprintf(stderr, "mmspd: stopped after %llu jobs\n", g_stats.jobs);
+    return 0;
+}
+
+/* ========================== Client ========================== */
+static uint8_t* read_file(const char* path, size_t* len){
+    FILE* f = fopen(path,"rb");
+    if(!f) return NULL;
+    size_t n=0, cap=1<<16;
+    uint8_t* buf = (uint8_t*)malloc(cap);
+    if(!buf) die("OOM");
+    for(size_t k; (k=fread(buf+n,1,cap-n,f))>0; ){
+        n += k;
+        if(n==cap){
+            cap *= 2;
+            buf = (uint8_t*)realloc(buf,cap);
+            if(!buf) die("OOM");
+        }
+    }
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+static void send_file(int fd, const char* path){
+    size_t len=0;
+    uint8_t* data = read_file(path, &len);
+    if(!data){
+        fprintf(stderr, "ERROR: open %s failed\n", path);
+        exit(1);
+    }
+    if(len>MAX_PART_BYTES) die("input too large");
+    if(!write_blob(fd,data,len)) die("send failed");
+    free(data);
+}
+
+static int client(const char* path, int argc, char** argv){
+    const char* cmd = argv[0];
+    int op = strcmp(cmd,"encode")==0 ? 'E' : strcmp(cmd,"decode")==0 ? 'D' : strcmp(cmd,"stats")==0 ? 'S' : 0;
+    if(!op){ usage(); return 1; }
+
+    int method=0, flags=0;
+    int i=1;
+    if(op!='S'){
+        if(argc<2){ usage(); return 1; }
+        method = atoi(argv[i++]);
+        for(; i<argc && strncmp(argv[i],"--",2)==0; i++){
+            const char* o = argv[i]+2;
+            if(strcmp(o,"ascii")==0) flags |= FLAG_ASCII;
+            else if(op=='E' && strcmp(o,"progressive")==0) flags |= FLAG_PROGRESSIVE;
+            else if(op=='E' && strcmp(o,"index")==0) flags |= FLAG_INDEX;
+            else if(op=='E' && strcmp(o,"lossless")==0) flags |= FLAG_LOSSLESS;
+            else{ fprintf(stderr,"unknown option --%s\n", o); die("bad option"); }
+        }
+    }
+    // encode: input.bmp then outputs; decode: out.bmp then inputs
+    int nfiles = argc - i;
+    char** files = argv + i;
+    if(op!='S' && nfiles<2){ usage(); return 1; }
+    int nsend = (op=='S') ? 0 : (op=='E') ? 1 : nfiles-1;
+    if(nsend>MMSP_MAX_PARTS) die("too many inputs");
+    if(op!='S' && (method<0 || method>5)) die("METHOD must be 0..5");
+    // the file count must fit the method before the server does any work
+    // (mmspd encode has no interleaved Method-1 form)
+    if(op=='E' && nfiles-1 != mmsp_enc_nparts(method,0)){
+        fprintf(stderr, "ERROR: encode %d takes input.bmp and %d output files\n", method, mmsp_enc_nparts(method,0));
+        return 1;
+    }
+    if(op=='D' && !mmsp_dec_nin_ok(method, nfiles-1)){
+        fprintf(stderr, "ERROR: decode %d: wrong number of input files (see decoder usage)\n", method);
+        return 1;
+    }
+
+    size_t dim_len=0;
+    uint8_t* dim = NULL;
+    if(op=='D' && method>=2){
+        dim = read_file("dim.txt", &dim_len);
+        if(dim) flags |= FLAG_DIM;
+    }
+
+    struct sockaddr_un addr;
+    fill_addr(&addr, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd<0 || connect(fd,(struct sockaddr*)&addr,sizeof(addr))!=0) die("connect failed (is mmspd serving?)");
+
+    uint8_t h[8] = { 'M','J','0','1', (uint8_t)op, (uint8_t)method, (uint8_t)flags, (uint8_t)nsend };
+    if(!write_full(fd,h,8)) die("send failed");
+    if(op=='E') send_file(fd, files[0]);
+    if(op=='D') for(int k=1;k<nfiles;k++) send_file(fd, files[k]);
+    if(dim){
+        if(!write_blob(fd,dim,dim_len)) die("send failed");
+        free(dim);
+    }
+
+    uint8_t rh[2];
+    if(!read_full(fd,rh,2)) die("no response");
+    int status = rh[0], nparts = rh[1];
+    int rc = 0;
+    for(int k=0;k<nparts;k++){
+        mmsp_buf b;
+        if(!read_blob(fd,&b)) die("short response");
+        if(status!=MMSP_OK){
+            fprintf(stderr, "ERROR: %.*s\n", (int)b.len, (const char*)b.data);
+            rc = 1;
+        }else if(op=='S'){
+            fwrite(b.data,1,b.len,stdout);
+        }else{
+            // encode: parts go to files[1..]; decode: the BMP to files[0]
+            const char* out = (op=='E') ? (k+1<nfiles ? files[k+1] : NULL) : files[0];
+            if(!out) die("more output parts than output files");
+            FILE* f = fopen(out,"wb");
+            if(!f) die("open output failed");
+            if(b.len && fwrite(b.data,1,b.len,f)!=b.len) die("write failed");
+            if(fclose(f)!=0) die("write failed");
+        }
+        free((void*)b.data);
+    }
+    close(fd);
+    return rc;
+}
+
+/* ========================== MAIN ========================== */
+int main(int argc, char** argv){
+    if(argc < 3){ usage(); return 1; }
+    const char* path = argv[1];
+    if(strcmp(argv[2],"serve")==0){
+        int workers = 0, qcap = 64;
+        for(int i=3;i<argc;i++){
+            if(strcmp(argv[i],"--workers")==0 && i+1<argc) workers = atoi(argv[++i]);
+            else if(strcmp(argv[i],"--queue")==0 && i+1<argc) qcap = atoi(argv[++i]);
+            else{ usage(); return 1; }
+        }
+        return serve(path, workers, qcap);
+    }
+    return client(path, argc-2, argv+2);
+}